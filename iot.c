@@ -1,25 +1,127 @@
 /* Simple multi-threaded I/O benchmark program.
  *
  * To compile:
- *   gcc -o iot iot.c -lpthread
+ *   gcc -o iot iot.c -lpthread -lm
  * To run:
  *   Either with disk device or with pre-existing file.
- *    ./iot [options] filename
- *   Filename is the file or device to test on.
+ *    ./iot [options] filename...
+ *   Filename is the file or device to test on.  With several of them
+ *   (a JBOD, a set of data files), each I/O goes to one of the targets:
+ *     -m how - rr: round-robin (default), stripe[:unit]: by offset, as
+ *       RAID 0 does (unit 64k by default), thread: each thread sticks to
+ *       one target.  Targets are used up to the size of the smallest one;
+ *       log appends (-L) and trace replay (-F) go to the first one only.
+ *       Results are reported per target as well as in total.
+ *   Job file:
+ *    -J file - run the workload groups described in file, each in its own
+ *      [section] with target, mode, bs, threads, rate and time keys, all at
+ *      once (and along with the modes given on the command line); each
+ *      group gets its own statistics.  Targets need not be given then.
+ *   Precomputed positions:
+ *    -x n[,file] - draw n random block numbers (log record sizes for -L)
+ *      per thread before the run, and have the threads cycle through
+ *      them instead of calling the generator per I/O.  Each thread's
+ *      sequence has its own seed, so runs are reproducible; with a file
+ *      it is kept there, memory mapped, and reused when it matches.
+ *   Think time:
+ *    -Z [mode=]dist,... - wait between the I/Os of each thread (of the
+ *      mode, or all): a fixed time, exp:mean, uni:min:max, or file:name
+ *      to draw from the times listed in it (think= for jobs).  Waits
+ *      sleep, then spin for the last bit (spin=time, default 50us), so
+ *      even sub-microsecond think times are kept.
+ *   Load phases:
+ *    -G phase,... - vary the rate of the command line modes' threads
+ *      (trace replay excepted) over time: time@rate holds it, time@r1~r2
+ *      ramps it, time@base/burst:period:len bursts every period, and
+ *      -G @file follows a rate curve ("sec rate [name]" lines).  Phases
+ *      may be named (name=...); interval statistics (-v) show the phase.
+ *      The run lasts as long as the schedule unless -t is given, in which
+ *      case the schedule repeats.
+ *   I/O priority:
+ *    -p [mode=]class[:level],... - ioprio_set() the threads of the mode
+ *      (LinRd, RndWr...; all if none) to class rt, be or idle; prio=
+ *      does the same for a job.  Latency is reported per mode and per job,
+ *      so how well the I/O scheduler protects one from another shows.
  *   By default it uses 8Kb I/O blocks and does sequential read test
  *   until interrupted.
  *   To indicate when to stop:
- *     -t sec - run for this many seconds, say, 30, to eliminate random
- *       noise.
- *     -i num - perform this many I/O operations
+ *     -t time - run for this long, say, 30 (seconds), to eliminate random
+ *       noise.  Fractions and ns/us/ms/s/m/h suffixes are accepted, eg
+ *       -t250ms; the deadline is checked by workers against monotonic clock.
+ *     -i num - perform this many I/O operations (in each thread)
+ *     -I num - perform this many I/O operations in total (all threads)
+ *   Timing:
+ *    -T0, -T1 - use CLOCK_MONOTONIC or the CPU timestamp counter for
+ *      per-I/O latency; by default TSC is used when it is invariant.
+ *   At the end, CPU time spent per I/O (by the worker threads, and by the
+ *   whole system during the run) is reported for each mode.
+ *    -P - also count perf events in each worker around the I/O loop and
+ *      report them per I/O; hardware counters are used when available.
+ *    -v time - print I/O rates every time interval, along with the
+ *      statistics of the underlying block device (from sysfs), so the
+ *      application and block layer views can be compared.
+ *   Page cache (for buffered I/O):
+ *    -e - evict the target's pages from page cache before the run
+ *    -a adv - posix_fadvise() workers' files with given advice
+ *    -c - report how much of the target was cached before and after
+ *   Readahead (for buffered linear reads):
+ *    -A win - issue readahead() for win bytes ahead of linear readers
+ *    -X list - sweep device readahead (read_ahead_kb), one run per value
+ *   Interrupt (^C) stops all workers and prints the results so far.
  *   To indicate R/W mode:
  *     -wn, -Wn, -rn, -Rn --
  *       perform linear or random write (note: all data will be lost!),
  *       or linear or random read, using given number of threads (n).
+ *     -Ln - append variable size records (-l min,max) to a log, as a
+ *       database WAL does: concurrent writers' records are committed
+ *       together with one write and fdatasync (-g delay,max controls the
+ *       grouping).  Per-record commit latency is reported.
+ *     -Un - read a random block, change a few (-u) bytes of it and write
+ *       it back, as database page updates do.  Combined latency and that
+ *       of the read and write parts are reported; use -y to flush.
+ *     -K rd=n,fl=n,cp=n,... - emulate an LSM-tree store: small random
+ *       point reads, sequential flush writes and large compaction reads
+ *       and writes, each with own thread count, size and rate limit,
+ *       all at once.  Point read latency shows what compaction costs.
+ *     -F trace - replay an I/O trace (text or binary) with its original
+ *       timing, scaled (-S) or as fast as possible (-S0), by -j workers
+ *       each taking its own streams, in order.
+ *   I/O recording:
+ *    -O file - record every I/O (thread, op, offset, size, submit time and
+ *      latency) into file, in the binary format -F replays.  Workers only
+ *      put entries into their rings; a background thread writes them out.
+ *    -k n - report the n slowest I/Os (default 10): offset (for log
+ *      appends, where the record went in the log), size, mode, thread,
+ *      when, and how many I/Os were in flight as it completed.
+ *   Test targets:
+ *    -C size[,n] - create target files (or extend them) to size, with
+ *      fallocate() and then writing the data pattern all over the new
+ *      part by n threads (one per CPU by default), so the test does not
+ *      read holes.  -E removes the files created when done.
+ *    -f pattern - data written: zero (default), rand (incompressible,
+ *      every 4k block distinct when filling) or a byte value
+ *    -D max[,n] - precondition (SSDs) before measuring: write the targets
+ *      sequentially end to end, then overwrite random bs blocks in 1s
+ *      rounds until the write rate is steady (SNIA PTS rule over the last
+ *      5 rounds) or max times the capacity was overwritten (0 - no limit).
+ *      n helper threads (default one per CPU) and all the workers take
+ *      part, the workers on the fds they then measure with.
+ *   Framework overhead:
+ *    -N - null engine: I/Os complete at once, without a syscall (except
+ *      log appends and trace replay); the target defaults to /dev/null.
+ *    -B - self-benchmark: one random reader on the null engine, with
+ *      more and more of the per-I/O bookkeeping turned on; prints the
+ *      I/O rate iot itself can sustain and the cost per I/O.
  *   I/O modes:
  *    -s - syncronous write (O_SYNC)
  *    -d - direct I/O (O_DIRECT)
- *    -b bs - block size in bytes
+ *    -b bs - block size in bytes; "auto" picks one from the geometry.
+ *      The block size is checked against the device (or file system)
+ *      sector sizes and direct I/O alignment before the run.
+ *    -y how[:every] - flush writes with fsync or fdatasync every n writes
+ *      or time interval, sync_file_range() windows of so many bytes
+ *      (start writeback of each, wait for the one before), or RWF_DSYNC
+ *      per write; flush latency is reported separately.
  *   And finally:
  *    -h - display usage.
  * Example:
@@ -55,142 +157,2558 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <sys/time.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+#include <sys/sysmacros.h>
+#include <sys/syscall.h>
+#include <sys/prctl.h>
+#include <linux/perf_event.h>
 #include <signal.h>
 #include <pthread.h>
 #include <string.h>
+#include <stddef.h>
+#include <math.h>
 
 #ifndef BLKGETSIZE64
 #define BLKGETSIZE64 _IOR(0x12,114,size_t)
  /* linux-specific. return device size in bytes (u64 *arg) */
 #endif
+#ifndef BLKSSZGET
+#define BLKSSZGET _IO(0x12,104)	/* logical sector size (int *arg) */
+#endif
+#ifndef BLKIOMIN
+#define BLKIOMIN _IO(0x12,120)	/* minimum I/O size (unsigned *arg) */
+#define BLKIOOPT _IO(0x12,121)	/* optimal I/O size (unsigned *arg) */
+#endif
+#ifndef RWF_DSYNC
+#define RWF_DSYNC 0x00000002	/* per-write O_DSYNC for pwritev2() */
+#endif
+#ifndef BLKPBSZGET
+#define BLKPBSZGET _IO(0x12,123)	/* physical sector size (unsigned *arg) */
+#endif
+#ifndef IOPRIO_CLASS_SHIFT
+#define IOPRIO_CLASS_SHIFT 13		/* from linux/ioprio.h */
+#define IOPRIO_WHO_PROCESS 1
+#endif
+
+static void edie(const char *what) {
+  fprintf(stderr, "%s: %m \n", what);
+  exit(1);
+}
+
+#ifdef USE_DEV_URANDOM
+static int randfd;
+#endif
+static int oflags;		// open flags
+static char *fn;		// filename (of the first target)
+static unsigned bs = 8192;	// block size, 0 - pick from geometry
+static unsigned bc;		// block count (device size in blocks)
+static unsigned bm;		// blocks to do
+static unsigned long long gbm;	// blocks to do in total, by all threads
+static unsigned long long gbc;	// blocks claimed from gbm so far
+static unsigned long long dl;	// deadline (ticks), 0 - none
+static unsigned ntga;		// targets given as arguments
+
+/* How I/O is spread over several targets (-m); bc is then the size of
+ * the smallest one, or, striped, that times the number of targets. */
+#define TDrr		0	// each thread goes round the targets
+#define TDstripe	1	// by offset, in tsu stripe units
+#define TDthread	2	// thread n uses target n % ntga only
+static unsigned ntg;		// number of targets, with those of jobs
+static int tdist;		// TDrr, TDstripe or TDthread
+static unsigned long long tsu = 64 << 10;	// stripe unit, bytes
+static unsigned long long tgsz;	// bytes used of each target
+
+/* Time is measured in ticks: CLOCK_MONOTONIC nanoseconds, or, when the
+ * CPU has an invariant TSC, raw TSC cycles calibrated against the former.
+ * Ticks are converted to nanoseconds only when reporting (tk2ns). */
+typedef unsigned long long tick_t;
+static int usetsc = -1;		// use TSC for ticks (-1: if invariant)
+static double nspt = 1;		// nanoseconds per tick
+
+#define MFrnd   1
+#define MFwrt   2
+#define MFrmw   4	// read, then write back
+#define LinRd	0
+#define RndRd	MFrnd
+#define LinWr	MFwrt
+#define RndWr	(MFrnd|MFwrt)
+#define LogWr	4	// log append with group commit (-L)
+#define RmwUp	5	// read-modify-write of random blocks (-U)
+#define LsmRd	6	// LSM point reads (-K)
+#define LsmFl	7	// LSM memtable flush writes
+#define LsmCp	8	// LSM compaction reads and writes
+#define Replay	9	// trace replay (-F)
+#define NM	10	// number of modes
+static const unsigned mfl[NM] = {
+  LinRd, RndRd, LinWr, RndWr, MFwrt, MFrmw|MFrnd|MFwrt,
+  RndRd, LinWr, MFrmw|MFwrt, MFrmw|MFwrt
+};
+static unsigned msz[NM];	// I/O size of mode, 0 - bs
+static double mrate[NM];	// bytes/s limit of mode (all its threads)
+static int mprio[NM];		// I/O priority of mode's threads, 0 - none
+static struct think *mthk[NM];	// think time of mode's threads, NULL - none
+
+/* Per-worker perf events (-P).  Hardware counters are often unavailable
+ * (VMs, perf_event_paranoid); the software ones always work, so we still
+ * get context switches and CPU time.  When kernel counting is denied,
+ * retry counting user space only (marked with :u in the report). */
+static const struct pev {
+  unsigned type;
+  unsigned long long cfg;
+  const char *name;
+} pev[] = {
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles" },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instr" },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache-miss" },
+  { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "ctx-sw" },
+  { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, "task-ns" },
+  { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, "faults" },
+};
+#define NPEV (sizeof(pev)/sizeof(pev[0]))
+static int perf;		// use perf events
+static int pevu[NPEV];		// event counts user space only
+static int pevw[NPEV];		// warned about event being unavailable
+
+/* Latency histogram, in ticks: log2 buckets split into 1<<HSUB linear
+ * sub-buckets each, so every bucket is within 1/16 of its value. */
+#define HSUB 4
+#define HBKT (64 << HSUB)
+struct hist {
+  unsigned long long n[HBKT];
+};
+
+static inline unsigned hidx(tick_t v) {
+  unsigned m;
+  if (v < (1u << HSUB)) return v;
+  m = 63 - __builtin_clzll(v);
+  return ((m - HSUB + 1) << HSUB) + ((v >> (m - HSUB)) & ((1u << HSUB) - 1));
+}
+static inline void hadd(struct hist *h, tick_t v) {
+  ++h->n[hidx(v)];
+}
+
+/* Flushing of writes (-y): fsync or fdatasync every fsn writes or every
+ * fst, sync_file_range() windows of fsb bytes, or RWF_DSYNC on
+ * each write.  Flush latency goes to its own histogram. */
+#define FSfsync		1
+#define FSfdatasync	2
+#define FSsfr		3
+#define FSdsync		4
+static int fsm;			// flush method, 0 - none
+static unsigned fsn;		// flush every fsn writes
+static unsigned long long fst;	// or every fst (ns, ticks after tkinit())
+static unsigned long long fsb;	// sync_file_range() window, bytes
+static const char *const fsmn[] = { "", "fsync", "fdatasync", "sfr", "dsync" };
+
+/* Binary I/O trace record, as replayed by -F */
+#define TRMAGIC "IOTTRC1\n"
+#define TRrd	0
+#define TRwr	1
+#define TRfl	2
+struct trec {
+  unsigned long long ts;	// submit time, ns
+  unsigned long long off;	// offset, bytes
+  unsigned len;			// length, bytes
+  unsigned lat;			// latency, ns (0 - unknown)
+  unsigned short strm;		// stream (thread) number
+  unsigned char op;		// TRrd, TRwr or TRfl
+  unsigned char pad[5];
+};
+
+/* I/O recording (-O): each worker puts an entry per I/O into its own
+ * single producer, single consumer ring, which a background thread
+ * drains into a binary trace (TRMAGIC, then struct trec).  Entries are
+ * dropped, and counted, when a ring is full; workers never wait. */
+struct tent {
+  tick_t t0, t1;		// submit and completion time
+  unsigned long long off;
+  unsigned len;
+  unsigned op;
+};
+#define TRING (1u << 16)	// entries per ring
+
+/* Slowest I/Os (-k): each worker keeps the nslow slowest I/Os it did in
+ * a min-heap on latency, with the number of I/Os in flight (in all
+ * threads) as each completed.  Merged and printed at the end.  Workers
+ * only flag their own I/O in flight; the flags are counted when an I/O
+ * makes it into a heap. */
+struct slow {
+  struct tent e;
+  unsigned infl;		// I/Os in flight at completion, this one included
+  unsigned short opi, thr;	// mode and thread number
+  unsigned short tg;		// target
+};
+static unsigned nslow = 10;	// slow I/Os to keep per thread, 0 - none
+
+/* per thread statistics of each target */
+struct tgst {
+  int fd;		// -1 if the thread does not use the target
+  unsigned long long ioc, ioby;	// I/O count, bytes transferred
+  tick_t lsum;		// sum of I/O latencies
+  unsigned fsnw;	// writes since its last flush
+  tick_t fstm;		// time of its last flush
+  unsigned long long wby;	// bytes in the sync_file_range() window
+  off_t wlo, whi;	// range the window spans
+  off_t plo, phi;	// the previous window, being written back
+};
+
+struct state {
+  int fd;
+  char *buf;
+  unsigned ioc;		// I/O count
+  unsigned long long ioby;	// bytes transferred
+  int (*workfn)(struct state *, unsigned blocknr);
+  unsigned (*posfn)(struct state *s);
+  unsigned opi;		// operation index
+  unsigned i;		// curidx
+  tick_t stime;		// start time
+  unsigned bn;		// current block number for linear i/o
+  unsigned rab;		// first block not yet read ahead (-A)
+  unsigned iosz;	// I/O size
+  unsigned nb;		// target size in iosz units
+  double rate;		// bytes/s limit, 0 - none
+  unsigned long long pns;	// pacing start (ns)
+  struct trec tr;	// current trace record
+  int eot;		// end of trace reached
+  char *rbuf;		// buffer allocated for large trace records
+  unsigned bcap;	// size of buf
+  struct tent *ring;	// recording ring (-O)
+  unsigned rhead, rtail;	// ring producer and consumer positions
+  unsigned long long rdrop;	// entries dropped, ring full
+  struct slow *slow;	// slowest I/O heap (-k)
+  unsigned nsl;		// entries in it
+  struct tgst *tg;	// per target fds and statistics
+  unsigned tgc;		// target of current I/O
+  unsigned tgn;		// round-robin target counter
+  int tgm;		// I/Os are spread over all targets
+  unsigned job;		// job number + 1, 0 - none
+  int prio;		// I/O priority, 0 - none
+  int php;		// paced by the phase schedule (-G)
+  unsigned ph;		// current phase
+  unsigned phseg;	// phase and burst state of the last I/O
+  unsigned long long pdue;	// phase pacing: next I/O due (ns)
+  unsigned long long pby;	// bytes accounted for in pdue
+  const struct think *thk;	// think time, NULL - none
+  tick_t thsum;		// time spent thinking
+  unsigned long long thask;	// think time asked for, ns
+  unsigned long long thn;	// number of waits
+  const unsigned *sch;	// precomputed positions (-x), NULL - none
+  unsigned schi;	// next one
+  tick_t dl;		// deadline, 0 - none
+  tick_t etime;		// end time
+  unsigned long long loff;	// log offset of the last record appended
+  tick_t lsum;		// sum of I/O latencies
+  tick_t lmax;		// max I/O latency
+  int busy;		// an I/O is in flight (-k)
+  double cpuu, cpus;	// user and system CPU seconds used by the thread
+  int pfd[NPEV];	// perf event fds, -1 if not available
+  unsigned long long pv[NPEV];	// perf event counts
+  unsigned fsc;		// flush count
+  struct hist lh;	// I/O latency histogram
+  struct hist fh;	// flush latency histogram
+  struct hist rh, wh;	// read and write parts of read-modify-write
+};
+
+static struct state *states;
+static char *bufs;		// I/O buffers of all threads
+static unsigned maxbs;		// size of each thread's buffer
+static unsigned nt[NM];
+static unsigned ntt;
+static volatile unsigned running;
+static const char *const ion[NM] = {
+  "LinRd", "RndRd", "LinWr", "RndWr", "LogWr", "RmwUp",
+  "LsmRd", "LsmFl", "LsmCp", "Replay"
+};
+
+static pthread_mutex_t rnmtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t rncond = PTHREAD_COND_INITIALIZER;
+
+/* monotonic clock in nanoseconds */
+static unsigned long long nsnow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_TSC 1
+static inline tick_t rdtsc(void) {
+  unsigned lo, hi;
+  __asm__ __volatile__("rdtsc" : "=a" (lo), "=d" (hi));
+  return (tick_t)hi << 32 | lo;
+}
+#else
+#define HAVE_TSC 0
+#define rdtsc() 0
+#endif
+
+/* current time in ticks; cheap enough to call around every I/O */
+static inline tick_t ticks(void) {
+  return HAVE_TSC && usetsc ? rdtsc() : nsnow();
+}
+static double tk2ns(tick_t t) {
+  return t * nspt;
+}
+static tick_t ns2tk(unsigned long long ns) {
+  return ns / nspt;
+}
+
+/* TSC is only usable as a clock when it ticks at constant rate and does
+ * not stop in deep C-states; the kernel tells us so in cpu flags. */
+static int tscinvariant(void) {
+  char l[4096];
+  int r = 0;
+  FILE *f = fopen("/proc/cpuinfo", "r");
+  if (!f) return 0;
+  while(fgets(l, sizeof(l), f))
+    if (strncmp(l, "flags", 5) == 0) {
+      r = strstr(l, " constant_tsc") && strstr(l, " nonstop_tsc");
+      break;
+    }
+  fclose(f);
+  return r;
+}
+
+/* choose the tick source and calibrate TSC against CLOCK_MONOTONIC */
+static void tkinit(void) {
+  unsigned long long n0, n1;
+  tick_t t0, t1;
+  if (usetsc < 0)
+    usetsc = HAVE_TSC && tscinvariant();
+  else if (usetsc && !HAVE_TSC) {
+    fprintf(stderr, "TSC is not available on this platform\n");
+    exit(1);
+  }
+  if (!usetsc) return;
+  n0 = nsnow(); t0 = rdtsc();
+  do n1 = nsnow(); while(n1 - n0 < 20000000);	// 20ms
+  t1 = rdtsc();
+  nspt = (double)(n1 - n0) / (t1 - t0);
+}
+
+/* parse time interval: number (fractions ok) with optional suffix
+ * ns, us, ms, s (default), m or h.  Returns nanoseconds. */
+static unsigned long long parsetm(const char *a) {
+  static const struct { const char *sfx; double mul; } u[] = {
+    { "ns", 1 }, { "us", 1e3 }, { "ms", 1e6 }, { "s", 1e9 }, { "", 1e9 },
+    { "m", 60e9 }, { "h", 3600e9 },
+  };
+  char *e;
+  double v = strtod(a, &e);
+  unsigned i;
+  for(i = 0; i < sizeof(u)/sizeof(u[0]); ++i)
+    if (strcmp(e, u[i].sfx) == 0 && v >= 0 && e != a)
+      return v * u[i].mul;
+  fprintf(stderr, "invalid time interval `%s'\n", a);
+  exit(1);
+}
+
+/* parse size in bytes with optional k, m, g or t suffix (binary units) */
+static unsigned long long parsesz(const char *a) {
+  char *e;
+  unsigned long long v = strtoull(a, &e, 0);
+  switch(*e) {
+  case 't': case 'T': v <<= 10;
+  case 'g': case 'G': v <<= 10;
+  case 'm': case 'M': v <<= 10;
+  case 'k': case 'K': v <<= 10; ++e;
+  }
+  if (e == a || *e) {
+    fprintf(stderr, "invalid size `%s'\n", a);
+    exit(1);
+  }
+  return v;
+}
+
+static unsigned randpos(struct state *s) {
+  unsigned n;
+#ifdef USE_DEV_URANDOM
+  read(randfd, &n, sizeof(n));
+#else
+  n = lrand48();
+#endif
+  s = s;
+  return n % bc;
+}
+
+static unsigned linpos(struct state *s) {
+  if (s->bn >= bc)
+    s->bn = 0;
+  return s->bn++;
+}
+
+/* target of I/O at block b (in iosz units) of the thread; for stripes,
+ * b is changed to the block within that target */
+static unsigned tgmap(struct state *s, unsigned *b) {
+  unsigned long long o, su;
+  if (tdist == TDrr)
+    return s->tgn++ % ntga;
+  o = (unsigned long long)*b * s->iosz;
+  su = o / tsu;
+  *b = (su / ntga * tsu + o % tsu) / s->iosz;
+  return su % ntga;
+}
+
+/* Explicit readahead for linear readers (-A): keep the next raw blocks
+ * past the cursor requested, topping the window up when less than half
+ * of it is left, with readahead() or posix_fadvise(WILLNEED). */
+static unsigned raw;		// readahead window in blocks, 0 - none
+static int rawn;		// use fadvise(WILLNEED) instead of readahead()
+
+static unsigned linrapos(struct state *s) {
+  unsigned b = linpos(s), e;
+  if (b < s->rab && s->rab - b > raw / 2 && s->rab <= bc)
+    return b;
+  if (s->rab < b || s->rab > bc) s->rab = b;
+  e = b + raw < bc ? b + raw : bc;
+  if (e > s->rab) {
+    off_t o = (off_t)s->rab * bs, l = (off_t)(e - s->rab) * bs;
+    if (rawn) posix_fadvise(s->fd, o, l, POSIX_FADV_WILLNEED);
+    else readahead(s->fd, o, l);
+    s->rab = e;
+  }
+  return b;
+}
+
+/* Read-modify-write (-U): read a block, change rmwsz bytes of it at a
+ * random place, and write it back, as a buffer pool page update does.
+ * The read and write latencies are kept apart as well. */
+static unsigned rmwsz = 16;
+
+static int wrmw(struct state *s, unsigned b) {
+  off_t o = (off_t)b * bs;
+  tick_t t0 = ticks(), t1;
+  int r;
+  if ((r = pread(s->fd, s->buf, bs, o)) < 0)
+    return r;
+  t1 = ticks();
+  hadd(&s->rh, t1 - t0);
+  memset(s->buf + lrand48() % (bs - rmwsz + 1), s->ioc, rmwsz);
+  if (fsm == FSdsync) {
+    struct iovec iov = { s->buf, bs };
+    r = pwritev2(s->fd, &iov, 1, o, RWF_DSYNC);
+  }
+  else
+    r = pwrite(s->fd, s->buf, bs, o);
+  if (r < 0)
+    return r;
+  hadd(&s->wh, ticks() - t1);
+  return 2 * bs;
+}
+
+/* LSM-tree store emulation (-K): foreground point reads (bloom filter
+ * misses go to disk) of small random blocks, sequential memtable flush
+ * writes, and compaction reading large random chunks of old tables while
+ * writing the merged ones sequentially.  Each stream has its own size,
+ * rate and threads; all run at once on the target so the effect of the
+ * background streams on the read tail can be seen. */
+static unsigned szrpos(struct state *s) {
+  return lrand48() % s->nb;
+}
+static unsigned szlpos(struct state *s) {
+  if (s->bn >= s->nb)
+    s->bn = 0;
+  return s->bn++;
+}
+static int wszread(struct state *s, unsigned b) {
+  return pread(s->fd, s->buf, s->iosz, (off_t)b * s->iosz);
+}
+static int wszwrite(struct state *s, unsigned b) {
+  return pwrite(s->fd, s->buf, s->iosz, (off_t)b * s->iosz);
+}
+static int wszdwrite(struct state *s, unsigned b) {
+  struct iovec iov = { s->buf, s->iosz };
+  return pwritev2(s->fd, &iov, 1, (off_t)b * s->iosz, RWF_DSYNC);
+}
+/* read a random chunk of an old table, write it to the new one */
+static int wcompact(struct state *s, unsigned b) {
+  tick_t t0 = ticks(), t1;
+  unsigned rb = szrpos(s);
+  int r, fd = s->tgm ? s->tg[tgmap(s, &rb)].fd : s->fd;
+  if ((r = pread(fd, s->buf, s->iosz, (off_t)rb * s->iosz)) < 0)
+    return r;
+  t1 = ticks();
+  hadd(&s->rh, t1 - t0);
+  if ((r = fsm == FSdsync ? wszdwrite(s, b) : wszwrite(s, b)) < 0)
+    return r;
+  hadd(&s->wh, ticks() - t1);
+  return 2 * s->iosz;
+}
+
+static void parselsm(char *a) {
+  static char *const so[] = {
+    "rd", "rdsz", "rdrate", "fl", "flsz", "flrate", "cp", "cpsz", "cprate",
+    NULL
+  };
+  char *v;
+  int k;
+  nt[LsmRd] = nt[LsmFl] = nt[LsmCp] = 1;
+  msz[LsmRd] = 4096;
+  msz[LsmFl] = msz[LsmCp] = 1 << 20;
+  while(*a) {
+    unsigned m;
+    if ((k = getsubopt(&a, so, &v)) < 0 || !v) {
+      fprintf(stderr, "-K: invalid option `%s'\n", v ? v : "");
+      exit(1);
+    }
+    m = LsmRd + k / 3;
+    switch(k % 3) {
+    case 0: nt[m] = atoi(v); break;
+    case 1: msz[m] = parsesz(v); break;
+    case 2: mrate[m] = parsesz(v); break;
+    }
+  }
+}
+
+/* I/O priority (-p, prio= of jobs): class and level as ioprio_set() takes
+ * them; levels are 0 (highest) to 7, 4 by default as the kernel does. */
+static const char *const iopcn[] = { "none", "rt", "be", "idle" };
+static int priow;		// warned about ioprio_set() failing
+
+static int parseprio(const char *a) {
+  const char *l = strchr(a, ':');
+  size_t n = l ? (size_t)(l - a) : strlen(a);
+  unsigned c, v = l ? atoi(l + 1) : 4;
+  for(c = 1; c < sizeof(iopcn)/sizeof(iopcn[0]); ++c)
+    if (strlen(iopcn[c]) == n && strncmp(a, iopcn[c], n) == 0) break;
+  if (c == sizeof(iopcn)/sizeof(iopcn[0]) || v > 7 ||
+      (l && strspn(l + 1, "0123456789") != strlen(l + 1))) {
+    fprintf(stderr, "invalid I/O priority `%s'\n", a);
+    exit(1);
+  }
+  return c << IOPRIO_CLASS_SHIFT | (c == 3 ? 0 : v);
+}
+
+/* class/level of I/O priority p, "" if none */
+static const char *prioname(int p, char *b, size_t n) {
+  if (!p) return "";
+  snprintf(b, n, " %s/%u", iopcn[p >> IOPRIO_CLASS_SHIFT],
+           p & ((1 << IOPRIO_CLASS_SHIFT) - 1));
+  return b;
+}
+
+/* parse -p: [mode=]class[:level],... */
+static void parsemprio(char *a) {
+  char *p, *v;
+  unsigned i;
+  for(p = strtok(a, ","); p; p = strtok(NULL, ",")) {
+    if (!(v = strchr(p, '='))) {
+      int x = parseprio(p);
+      for(i = 0; i < NM; ++i) mprio[i] = x;
+      continue;
+    }
+    *v++ = '\0';
+    for(i = 0; i < NM; ++i)
+      if (strcasecmp(p, ion[i]) == 0) break;
+    if (i == NM) {
+      fprintf(stderr, "-p: unknown mode `%s'\n", p);
+      exit(1);
+    }
+    mprio[i] = parseprio(v);
+  }
+}
+
+/* Think time (-Z, think= of jobs): how long a thread waits after an I/O
+ * completes before issuing the next one, to model clients which are not
+ * always busy.  Times are drawn from a fixed, exponential, uniform or
+ * empirical (listed in a file) distribution. */
+#define THfixed	0
+#define THexp	1
+#define THuni	2
+#define THemp	3
+struct think {
+  int kind;
+  unsigned long long a, b;	// fixed or mean; uniform min and max, ns
+  unsigned long long *v;	// empirical values, ns
+  size_t n;
+};
+static unsigned long long spinns = 50000;	// spin for the last this much
+
+static struct think *parsethk(const char *a) {
+  struct think *t = calloc(1, sizeof(*t));
+  const char *c = strchr(a, ':');
+  if (!t) edie("think time");
+  if (!c)
+    t->a = parsetm(a);
+  else if (strncmp(a, "exp:", 4) == 0) {
+    t->kind = THexp;
+    t->a = parsetm(c + 1);
+  }
+  else if (strncmp(a, "uni:", 4) == 0) {
+    char b[64], *m;
+    snprintf(b, sizeof(b), "%s", c + 1);
+    if (!(m = strchr(b, ':'))) {
+      fprintf(stderr, "think time: uni:min:max expected\n");
+      exit(1);
+    }
+    *m++ = '\0';
+    t->kind = THuni;
+    t->a = parsetm(b);
+    t->b = parsetm(m);
+    if (t->b < t->a) t->b = t->a;
+  }
+  else if (strncmp(a, "file:", 5) == 0) {
+    char l[64];
+    FILE *f = fopen(c + 1, "r");
+    if (!f) edie(c + 1);
+    t->kind = THemp;
+    while(fgets(l, sizeof(l), f)) {
+      l[strcspn(l, " \t\r\n#")] = '\0';
+      if (!l[0]) continue;
+      if (!(t->n & (t->n + 1)) &&
+          !(t->v = realloc(t->v, (t->n * 2 + 1) * sizeof(*t->v))))
+        edie("think time");
+      t->v[t->n++] = parsetm(l);
+    }
+    fclose(f);
+    if (!t->n) {
+      fprintf(stderr, "%s: no think times\n", c + 1);
+      exit(1);
+    }
+  }
+  else {
+    fprintf(stderr, "unknown think time distribution `%s'\n", a);
+    exit(1);
+  }
+  return t;
+}
+
+/* parse -Z: [mode=]dist,... and spin=time */
+static void parsemthk(char *a) {
+  char *p, *v;
+  unsigned i;
+  for(p = strtok(a, ","); p; p = strtok(NULL, ",")) {
+    struct think *t;
+    if ((v = strchr(p, '=')) && strncmp(p, "spin=", 5) == 0) {
+      spinns = parsetm(v + 1);
+      continue;
+    }
+    if (!v) {
+      t = parsethk(p);
+      for(i = 0; i < NM; ++i) mthk[i] = t;
+      continue;
+    }
+    *v++ = '\0';
+    for(i = 0; i < NM; ++i)
+      if (strcasecmp(p, ion[i]) == 0) break;
+    if (i == NM) {
+      fprintf(stderr, "-Z: unknown mode `%s'\n", p);
+      exit(1);
+    }
+    mthk[i] = parsethk(v);
+  }
+}
+
+/* Job file (-J): workload groups run at once, with own statistics.
+ *   [name]
+ *   target=file	(required)
+ *   mode=read|randread|write|randwrite	(default read)
+ *   bs=size		(default -b)
+ *   threads=n		(default 1)
+ *   rate=bytes/s	(of all its threads, default none)
+ *   time=interval	(default -t)
+ *   prio=class[:level]	(as -p, default none)
+ *   think=dist		(as -Z, default none)
+ * Lines starting with # or ; are comments. */
+#define NJOB 64
+static struct job {
+  char name[32];
+  char *fn;			// target
+  unsigned tg;			// its index in tgs
+  unsigned opi;			// mode: LinRd, RndRd, LinWr or RndWr
+  unsigned iosz;		// I/O size, 0 - bs
+  unsigned nt;			// threads
+  int prio;			// I/O priority, 0 - none
+  struct think *thk;		// think time, NULL - none
+  double rate;			// bytes/s limit, 0 - none
+  unsigned long long tm;	// duration (ns), 0 - as -t
+} jobs[NJOB];
+static unsigned njob;
+static const char *const jmn[] = { "read", "randread", "write", "randwrite" };
+
+static void jobbad(const char *path, unsigned ln, const char *l) {
+  fprintf(stderr, "%s:%u: invalid line `%s'\n", path, ln, l);
+  exit(1);
+}
+
+static void parsejob(const char *path) {
+  char l[1024], *k, *v, *e;
+  unsigned ln = 0, i;
+  struct job *j = NULL;
+  FILE *f = fopen(path, "r");
+  if (!f) edie(path);
+  while(fgets(l, sizeof(l), f)) {
+    ++ln;
+    k = l + strspn(l, " \t");
+    for(e = k + strlen(k); e > k && strchr(" \t\r\n", e[-1]); --e) ;
+    *e = '\0';
+    if (!*k || *k == '#' || *k == ';') continue;
+    if (*k == '[' && e[-1] == ']' && e - k > 2) {
+      if (njob == NJOB) {
+        fprintf(stderr, "%s:%u: too many jobs\n", path, ln);
+        exit(1);
+      }
+      j = &jobs[njob++];
+      snprintf(j->name, sizeof(j->name), "%.*s", (int)(e - k - 2), k + 1);
+      j->nt = 1;
+      continue;
+    }
+    if (!j || !(v = strchr(k, '='))) jobbad(path, ln, k);
+    for(e = v; e > k && (e[-1] == ' ' || e[-1] == '\t'); --e) ;
+    *e = '\0';
+    v += 1 + strspn(v + 1, " \t");
+    if (strcmp(k, "target") == 0) {
+      if (!(j->fn = strdup(v))) edie("strdup");
+    }
+    else if (strcmp(k, "mode") == 0) {
+      for(i = 0; i < sizeof(jmn)/sizeof(jmn[0]); ++i)
+        if (strcmp(v, jmn[i]) == 0) break;
+      if (i == sizeof(jmn)/sizeof(jmn[0])) jobbad(path, ln, k);
+      j->opi = i;		// LinRd, RndRd, LinWr, RndWr
+    }
+    else if (strcmp(k, "bs") == 0) j->iosz = parsesz(v);
+    else if (strcmp(k, "threads") == 0) j->nt = atoi(v);
+    else if (strcmp(k, "rate") == 0) j->rate = parsesz(v);
+    else if (strcmp(k, "time") == 0) j->tm = parsetm(v);
+    else if (strcmp(k, "prio") == 0) j->prio = parseprio(v);
+    else if (strcmp(k, "think") == 0) j->thk = parsethk(v);
+    else jobbad(path, ln, k);
+  }
+  fclose(f);
+  for(i = 0; i < njob; ++i)
+    if (!jobs[i].fn) {
+      fprintf(stderr, "%s: job %s has no target\n", path, jobs[i].name);
+      exit(1);
+    }
+}
+
+/* sleep until due (nsnow() time), but not past the thread's deadline.
+ * Returns 0 if the deadline has passed. */
+static int sleepdl(struct state *s, unsigned long long due) {
+  unsigned long long now = nsnow();
+  struct timespec ts;
+  if (s->dl) {
+    tick_t t = ticks();
+    if (t >= s->dl) return 0;
+    if (due > now + tk2ns(s->dl - t))
+      due = now + tk2ns(s->dl - t);
+  }
+  if (due > now) {
+    ts.tv_sec = due / 1000000000;
+    ts.tv_nsec = due % 1000000000;
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+  }
+  return !s->dl || ticks() < s->dl;
+}
+
+/* wait until the thread is not ahead of its rate.  Returns 0 if the
+ * deadline passed meanwhile. */
+static int pace(struct state *s) {
+  return sleepdl(s, s->pns + s->ioby / s->rate * 1e9);
+}
+
+static int wdwriter(struct state *s, unsigned b) {
+  struct iovec iov = { s->buf, bs };
+  return pwritev2(s->fd, &iov, 1, (off_t)b * bs, RWF_DSYNC);
+}
+static int wwriter(struct state *s, unsigned b) {
+  return pwrite(s->fd, s->buf, bs, (off_t)b * bs);
+}
+static int wreader(struct state *s, unsigned b) {
+  return pread(s->fd, s->buf, bs, (off_t)b * bs);
+}
+
+/* null engine (-N): complete at once, without a syscall */
+static int nullio;
+static int wnull(struct state *s, unsigned b) {
+  b = b;
+  return s->iosz;
+}
+
+/* print I/O rate per mode and job since the previous call (or reset
+ * if !f) */
+static void pivl(FILE *f, double sec) {
+  static unsigned long long pc[NM + NJOB], pb[NM + NJOB];
+  unsigned long long c[NM + NJOB] = { 0 }, b[NM + NJOB] = { 0 };
+  unsigned i;
+  if (!f) {		// reset for a new run
+    memset(pc, 0, sizeof(pc));
+    memset(pb, 0, sizeof(pb));
+    return;
+  }
+  for(i = 0; i < ntt; ++i) {
+    c[states[i].opi] += states[i].ioc;
+    b[states[i].opi] += states[i].ioby;
+    if (states[i].job) {
+      c[NM + states[i].job - 1] += states[i].ioc;
+      b[NM + states[i].job - 1] += states[i].ioby;
+    }
+  }
+  for(i = 0; i < NM + njob; ++i) {
+    if (c[i] - pc[i] || i >= NM || nt[i])
+      fprintf(f, " %s %.0f io/s %.2f MB/s",
+              i < NM ? ion[i] : jobs[i - NM].name, (c[i] - pc[i]) / sec,
+              (b[i] - pb[i]) / sec / 1024 / 1024);
+    pc[i] = c[i];
+    pb[i] = b[i];
+  }
+}
+
+/* merge histograms at offset ho in the states of threads doing mode opi
+ * (any if < 0) of job (number + 1, any if 0) */
+static unsigned long long hmerge(struct hist *h, int opi, unsigned job,
+                                 size_t ho) {
+  unsigned long long c = 0;
+  unsigned i, k;
+  memset(h, 0, sizeof(*h));
+  for(i = 0; i < ntt; ++i) {
+    const struct hist *t = (const struct hist *)((char *)&states[i] + ho);
+    if (opi >= 0 && states[i].opi != (unsigned)opi) continue;
+    if (job && states[i].job != job) continue;
+    for(k = 0; k < HBKT; ++k) {
+      h->n[k] += t->n[k];
+      c += t->n[k];
+    }
+  }
+  return c;
+}
+
+/* value (ns) below which fraction q of c samples of h fall: the middle
+ * of the bucket it falls into */
+static double hq(const struct hist *h, unsigned long long c, double q) {
+  unsigned long long a = 0, need = q * c;
+  unsigned k;
+  for(k = 0; k < HBKT - 1; ++k)
+    if ((a += h->n[k]) > need) break;
+  if (k < (1u << HSUB)) return tk2ns(k);
+  {
+    unsigned m = (k >> HSUB) + HSUB - 1;
+    tick_t lo = (1ULL << m) + ((tick_t)(k & ((1u << HSUB) - 1)) << (m - HSUB));
+    return tk2ns(lo) + tk2ns(1ULL << (m - HSUB)) / 2;
+  }
+}
+
+static void phist(FILE *f, const struct hist *h, unsigned long long c) {
+  static const double q[] = { .5, .9, .99, .999, .9999 };
+  static const char *const qn[] = { "p50", "p90", "p99", "p99.9", "p99.99" };
+  unsigned i;
+  for(i = 0; i < sizeof(q)/sizeof(q[0]); ++i)
+    fprintf(f, " %s %.1f", qn[i], hq(h, c, q[i]) / 1e3);
+  fprintf(f, " us\n");
+}
+
+/* latency percentiles of I/O and flushes for each mode */
+static void plat(FILE *f) {
+  struct hist h;
+  char pn[16];
+  unsigned long long c;
+  unsigned i, j, n;
+  for(i = 0; i < NM; ++i) {
+    if ((c = hmerge(&h, i, 0, offsetof(struct state, lh)))) {
+      fprintf(f, " %s%s lat", ion[i],
+              nt[i] ? prioname(mprio[i], pn, sizeof(pn)) : "");
+      phist(f, &h, c);
+    }
+    /* the read and write parts (compaction: reading and writing; a
+     * replayed trace may have only one) */
+    if ((mfl[i] & MFrmw) &&
+        (c = hmerge(&h, i, 0, offsetof(struct state, rh)))) {
+      fprintf(f, " %s read", ion[i]);
+      phist(f, &h, c);
+    }
+    if ((mfl[i] & MFrmw) &&
+        (c = hmerge(&h, i, 0, offsetof(struct state, wh)))) {
+      fprintf(f, " %s write", ion[i]);
+      phist(f, &h, c);
+    }
+    if (!(mfl[i] & MFwrt) ||
+        !(c = hmerge(&h, i, 0, offsetof(struct state, fh))))
+      continue;
+    for(j = n = 0; j < ntt; ++j)
+      if (states[j].opi == i) n += states[j].fsc;
+    fprintf(f, " %s %s %u", ion[i], i == Replay ? "flush" : fsmn[fsm], n);
+    phist(f, &h, c);
+  }
+}
+
+/* sync_file_range() windows: once fsb bytes were written to a target,
+ * start writeback of the range they span and wait for the window before
+ * it, so writeback runs a window behind the writes.  Returns 0 if the
+ * window is not full yet. */
+static int wsfr(struct state *s, off_t o) {
+  struct tgst *g = &s->tg[s->tgc];
+  if (!g->wby || o < g->wlo) g->wlo = o;
+  if (!g->wby || o + s->iosz > g->whi) g->whi = o + s->iosz;
+  if ((g->wby += s->iosz) < fsb)
+    return 0;
+  if (sync_file_range(g->fd, g->wlo, g->whi - g->wlo, SYNC_FILE_RANGE_WRITE) < 0 ||
+      (g->phi && sync_file_range(g->fd, g->plo, g->phi - g->plo,
+                                 SYNC_FILE_RANGE_WAIT_BEFORE |
+                                 SYNC_FILE_RANGE_WRITE |
+                                 SYNC_FILE_RANGE_WAIT_AFTER) < 0))
+    perror(fsmn[fsm]);
+  g->plo = g->wlo;
+  g->phi = g->whi;
+  g->wby = 0;
+  return 1;
+}
+
+/* flush written data if due after a write of block b completed at t.
+ * Writes and time are counted per target, and the target written to is
+ * flushed when due.  Returns the time the flush completed, or t. */
+static tick_t wflush(struct state *s, tick_t t, unsigned b) {
+  struct tgst *g = &s->tg[s->tgc];
+  tick_t t1;
+  ++g->fsnw;
+  if (fsm == FSsfr) {
+    if (!wsfr(s, (off_t)b * s->iosz))
+      return t;
+  }
+  else if (fsn ? g->fsnw < fsn : t - g->fstm < fst)
+    return t;
+  else if ((fsm == FSfsync ? fsync(g->fd) : fdatasync(g->fd)) < 0)
+    perror(fsmn[fsm]);
+  t1 = ticks();
+  hadd(&s->fh, t1 - t);
+  ++s->fsc;
+  g->fsnw = 0;
+  g->fstm = t1;
+  return t1;
+}
+
+/* parse -y: how[:every] */
+static void parsefs(char *a) {
+  char *e = strchr(a, ':');
+  unsigned i;
+  if (e) *e++ = '\0';
+  for(i = 1; i < sizeof(fsmn)/sizeof(fsmn[0]); ++i)
+    if (strcmp(a, fsmn[i]) == 0) break;
+  if (i == sizeof(fsmn)/sizeof(fsmn[0])) {
+    fprintf(stderr, "-y: unknown flush method `%s'\n", a);
+    exit(1);
+  }
+  fsm = i;
+  if (fsm == FSsfr)
+    fsb = e ? parsesz(e) : 1 << 20;
+  else if (!e || strspn(e, "0123456789") == strlen(e))
+    fsn = e ? atoi(e) : 1;
+  else
+    fst = parsetm(e);
+}
+
+static void pst(FILE *f) {
+  tick_t ct = ticks();
+  double r[NM] = { 0 };
+  unsigned c[NM] = { 0 };
+  tick_t ls[NM] = { 0 }, lm[NM] = { 0 };
+  unsigned i;
+  double d;
+  for(i = 0; i < ntt; ++i) {
+    struct state *s = &states[i];
+    if (!s->stime) continue;
+    d = tk2ns(ct - s->stime) / 1e9;
+    r[s->opi] += s->ioby / d;
+    c[s->opi] += s->ioc;
+    ls[s->opi] += s->lsum;
+    if (lm[s->opi] < s->lmax) lm[s->opi] = s->lmax;
+  }
+  for(i = 0; i < NM; ++i)
+    if (c[i])
+      fprintf(f, " %s %u %.2f lat %.1f/%.1fus", ion[i], c[i],
+              r[i] / 1024 / 1024,
+              tk2ns(ls[i]) / c[i] / 1e3, tk2ns(lm[i]) / 1e3);
+}
+
+/* statistics of each job: threads' I/O rate over the time they ran,
+ * average and max latency, and latency percentiles */
+static void pjob(FILE *f) {
+  struct hist h;
+  char pn[16];
+  unsigned i, j;
+  for(j = 0; j < njob; ++j) {
+    unsigned long long c = 0, b = 0;
+    tick_t ls = 0, lm = 0, t0 = 0, t1 = 0;
+    double d;
+    for(i = 0; i < ntt; ++i) {
+      struct state *s = &states[i];
+      if (s->job != j + 1 || !s->stime) continue;
+      c += s->ioc;
+      b += s->ioby;
+      ls += s->lsum;
+      if (lm < s->lmax) lm = s->lmax;
+      if (!t0 || s->stime < t0) t0 = s->stime;
+      if (t1 < s->etime) t1 = s->etime;
+    }
+    d = t1 > t0 ? tk2ns(t1 - t0) / 1e9 : 0;
+    fprintf(f, " job %s %s x%u%s on %s: %llu io %.0f io/s %.2f MB/s"
+               " lat %.1f/%.1fus\n", jobs[j].name, jmn[jobs[j].opi],
+            jobs[j].nt, prioname(jobs[j].prio, pn, sizeof(pn)), jobs[j].fn,
+            c, d ? c / d : 0,
+            d ? b / d / 1024 / 1024 : 0,
+            c ? tk2ns(ls) / c / 1e3 : 0, tk2ns(lm) / 1e3);
+    if ((c = hmerge(&h, -1, j + 1, offsetof(struct state, lh)))) {
+      fprintf(f, " job %s lat", jobs[j].name);
+      phist(f, &h, c);
+    }
+  }
+}
+
+/* open perf events for the calling thread, disabled */
+static void pevopen(struct state *s) {
+  struct perf_event_attr pa;
+  unsigned i;
+  for(i = 0; i < NPEV; ++i) {
+    memset(&pa, 0, sizeof(pa));
+    pa.size = sizeof(pa);
+    pa.type = pev[i].type;
+    pa.config = pev[i].cfg;
+    pa.disabled = 1;
+    pa.exclude_hv = 1;
+    pa.exclude_kernel = pevu[i];
+    pa.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED|PERF_FORMAT_TOTAL_TIME_RUNNING;
+    s->pfd[i] = syscall(__NR_perf_event_open, &pa, 0, -1, -1, 0);
+    if (s->pfd[i] < 0 && (errno == EACCES || errno == EPERM) && !pa.exclude_kernel) {
+      pa.exclude_kernel = 1;
+      s->pfd[i] = syscall(__NR_perf_event_open, &pa, 0, -1, -1, 0);
+      if (s->pfd[i] >= 0) pevu[i] = 1;
+    }
+    if (s->pfd[i] < 0 && !__sync_fetch_and_or(&pevw[i], 1))
+      fprintf(stderr, "perf event %s not available: %m\n", pev[i].name);
+  }
+  for(i = 0; i < NPEV; ++i)
+    if (s->pfd[i] >= 0)
+      ioctl(s->pfd[i], PERF_EVENT_IOC_ENABLE, 0);
+}
+
+/* stop perf events and collect counts, scaled if multiplexed */
+static void pevclose(struct state *s) {
+  unsigned long long v[3];
+  unsigned i;
+  for(i = 0; i < NPEV; ++i)
+    if (s->pfd[i] >= 0)
+      ioctl(s->pfd[i], PERF_EVENT_IOC_DISABLE, 0);
+  for(i = 0; i < NPEV; ++i) {
+    if (s->pfd[i] < 0) continue;
+    if (read(s->pfd[i], v, sizeof(v)) == sizeof(v) && v[2])
+      s->pv[i] = v[2] < v[1] ? (double)v[0] * v[1] / v[2] : v[0];
+    close(s->pfd[i]);
+  }
+}
+
+/* print perf event counts per I/O for each mode */
+static void ppev(FILE *f) {
+  unsigned long long v[NM][NPEV], c[NM][NPEV];
+  unsigned i, k;
+  memset(v, 0, sizeof(v));
+  memset(c, 0, sizeof(c));
+  for(i = 0; i < ntt; ++i)
+    for(k = 0; k < NPEV; ++k)
+      if (states[i].pfd[k] >= 0) {
+        v[states[i].opi][k] += states[i].pv[k];
+        c[states[i].opi][k] += states[i].ioc;
+      }
+  for(i = 0; i < NM; ++i) {
+    int n = 0;
+    for(k = 0; k < NPEV; ++k) {
+      if (!c[i][k]) continue;
+      if (!n++) fprintf(f, " %s perf", ion[i]);
+      fprintf(f, " %s%s %.3g", pev[k].name, pevu[k] ? ":u" : "",
+              (double)v[i][k] / c[i][k]);
+    }
+    if (n) fprintf(f, " /io\n");
+  }
+}
+
+/* thread CPU usage (user, system) in seconds */
+static void thrcpu(double *u, double *sy) {
+  struct rusage ru;
+  getrusage(RUSAGE_THREAD, &ru);
+  *u = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6;
+  *sy = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+/* system-wide busy and total CPU time, in clock ticks, from /proc/stat.
+ * iowait counts as idle.  Covers work done on behalf of us elsewhere:
+ * interrupts, softirqs, kernel threads completing our I/O. */
+static void syscpu(unsigned long long *busy, unsigned long long *tot) {
+  unsigned long long v[8] = { 0 };
+  FILE *f = fopen("/proc/stat", "r");
+  *busy = *tot = 0;
+  if (!f) return;
+  if (fscanf(f, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
+             &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]) >= 4) {
+    *busy = v[0] + v[1] + v[2] + v[5] + v[6] + v[7];
+    *tot = *busy + v[3] + v[4];
+  }
+  fclose(f);
+}
+
+/* print CPU cost per I/O for each mode and for the whole system.
+ * sb, st: system busy and total CPU ticks spent during the run. */
+static void pcpu(FILE *f, unsigned long long sb, unsigned long long st) {
+  double u[NM] = { 0 }, sy[NM] = { 0 };
+  unsigned long long c[NM] = { 0 }, tc = 0;
+  double hz = sysconf(_SC_CLK_TCK);
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned i;
+  for(i = 0; i < ntt; ++i) {
+    u[states[i].opi] += states[i].cpuu;
+    sy[states[i].opi] += states[i].cpus;
+    c[states[i].opi] += states[i].ioc;
+  }
+  for(i = 0; i < NM; ++i) {
+    if (!c[i]) continue;
+    tc += c[i];
+    fprintf(f, " %s cpu usr %.2f sys %.2f us/io, %.0f io/s/core\n", ion[i],
+            u[i] * 1e6 / c[i], sy[i] * 1e6 / c[i],
+            u[i] + sy[i] > 0 ? c[i] / (u[i] + sy[i]) : 0);
+  }
+  if (tc && st)
+    fprintf(f, " system cpu %.2f us/io, %.0f io/s/core (%ld cpus, %.1f%% busy)\n",
+            sb / hz * 1e6 / tc, sb ? tc / (sb / hz) : 0, ncpu,
+            100.0 * sb / st);
+}
+
+/* Block layer view of the targets: the whole-disk or partition stat file
+ * in sysfs (same format as /proc/diskstats, without the name). */
+struct dstat {
+  unsigned long long rd, rdm, rds, rdt;	// reads, merges, sectors, ms
+  unsigned long long wr, wrm, wrs, wrt;	// writes, merges, sectors, ms
+  unsigned long long inf, iot, tiq;	// in flight, busy ms, queue time ms
+};
+
+/* Targets (one or more file/device arguments) */
+static struct target {
+  char *fn;
+  char dsfn[80];		// sysfs stat file of the underlying device
+  char dname[32];		// its name
+  unsigned long long sz;	// bytes of it used
+  unsigned long long pcn;	// next chunk to fill (-D)
+  int mk;			// created by -C
+  struct dstat d0, di, d1;	// device stats at start, interval, end
+} *tgs;
+
+/* find the block device t lives on; leaves dsfn empty if none (tmpfs,
+ * network filesystems and the like) or if an earlier target has it */
+static void dsinit(struct target *t) {
+  struct stat st;
+  char sl[64], l[256], *p;
+  ssize_t n;
+  dev_t d;
+  struct target *o;
+  if (stat(t->fn, &st) < 0) return;
+  d = S_ISBLK(st.st_mode) ? st.st_rdev : st.st_dev;
+  if (!major(d)) return;
+  snprintf(sl, sizeof(sl), "/sys/dev/block/%u:%u", major(d), minor(d));
+  snprintf(t->dsfn, sizeof(t->dsfn), "%s/stat", sl);
+  for(o = tgs; o < t; ++o)
+    if (strcmp(o->dsfn, t->dsfn) == 0) {
+      t->dsfn[0] = '\0';
+      return;
+    }
+  if (access(t->dsfn, R_OK) < 0 || (n = readlink(sl, l, sizeof(l) - 1)) < 0) {
+    t->dsfn[0] = '\0';
+    return;
+  }
+  l[n] = '\0';
+  p = strrchr(l, '/');
+  snprintf(t->dname, sizeof(t->dname), "%.31s", p ? p + 1 : l);
+}
+
+static int dsget(const struct target *t, struct dstat *d) {
+  FILE *f;
+  int n;
+  if (!t->dsfn[0] || !(f = fopen(t->dsfn, "r"))) return 0;
+  n = fscanf(f, "%llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu",
+             &d->rd, &d->rdm, &d->rds, &d->rdt, &d->wr, &d->wrm, &d->wrs,
+             &d->wrt, &d->inf, &d->iot, &d->tiq);
+  fclose(f);
+  return n == 11;
+}
+
+/* print device statistics between two samples taken sec seconds apart:
+ * requests and MB/s completed, merges, average wait per request,
+ * utilization (time with requests in flight) and average queue size */
+static void pdev(FILE *f, const struct target *t, const struct dstat *a,
+                 const struct dstat *b, double sec) {
+  unsigned long long r = b->rd - a->rd, w = b->wr - a->wr;
+  double ms = sec * 1e3;
+  if (!t->dsfn[0] || sec <= 0) return;
+  fprintf(f, " dev %s r/s %.0f w/s %.0f rMB/s %.2f wMB/s %.2f"
+             " rrqm/s %.0f wrqm/s %.0f r_await %.2f w_await %.2f"
+             " svctm %.3f util %.1f%% aqu %.2f",
+          t->dname, r / sec, w / sec,
+          (b->rds - a->rds) * 512.0 / sec / 1024 / 1024,
+          (b->wrs - a->wrs) * 512.0 / sec / 1024 / 1024,
+          (b->rdm - a->rdm) / sec, (b->wrm - a->wrm) / sec,
+          r ? (double)(b->rdt - a->rdt) / r : 0,
+          w ? (double)(b->wrt - a->wrt) / w : 0,
+          r + w ? (double)(b->iot - a->iot) / (r + w) : 0,
+          (b->iot - a->iot) * 100.0 / ms, (b->tiq - a->tiq) / ms);
+}
+
+/* I/O rate and average latency per target over sec seconds */
+static void ptg(FILE *f, double sec) {
+  unsigned i, k;
+  for(k = 0; k < ntg; ++k) {
+    unsigned long long c = 0, b = 0;
+    tick_t l = 0;
+    for(i = 0; i < ntt; ++i) {
+      c += states[i].tg[k].ioc;
+      b += states[i].tg[k].ioby;
+      l += states[i].tg[k].lsum;
+    }
+    fprintf(f, " target %s %llu io %.0f io/s %.2f MB/s lat %.1fus\n",
+            tgs[k].fn, c, c / sec, b / sec / 1024 / 1024,
+            c ? tk2ns(l) / c / 1e3 : 0);
+  }
+}
+
+/* Device readahead sweep (-X): run the workload once per read_ahead_kb
+ * setting, then restore the original one.  Needs root. */
+static unsigned ra[32];		// read_ahead_kb values to sweep
+static unsigned nra;
+static unsigned ra0;		// original setting
+static char rafn[128];		// sysfs read_ahead_kb of the device
+
+static int raget(unsigned *kb) {
+  FILE *f = fopen(rafn, "r");
+  int r;
+  if (!f) return -1;
+  r = fscanf(f, "%u", kb) == 1 ? 0 : -1;
+  fclose(f);
+  return r;
+}
+
+static int raset(unsigned kb) {
+  FILE *f = fopen(rafn, "w");
+  if (!f) return -1;
+  fprintf(f, "%u\n", kb);
+  return fclose(f);
+}
+
+/* find read_ahead_kb of the device (or, for a partition, its disk) of
+ * the first target and check we are allowed to change it */
+static int rainit(void) {
+  const char *fmt[] = { "%.*s/queue/read_ahead_kb", "%.*s/../queue/read_ahead_kb" };
+  const char *dsfn = tgs[0].dsfn;
+  unsigned i;
+  int l = strlen(dsfn) - 5;		// strip "/stat"
+  if (!dsfn[0]) return -1;
+  for(i = 0; i < 2; ++i) {
+    snprintf(rafn, sizeof(rafn), fmt[i], l, dsfn);
+    if (raget(&ra0) == 0)
+      return access(rafn, W_OK);
+  }
+  return -1;
+}
+
+/* Target geometry.  For block devices it comes from the BLK* ioctls, for
+ * files from statx (direct I/O alignment, kernel 6.1+) and st_blksize. */
+static struct geom {
+  unsigned lbs;		// logical sector size
+  unsigned pbs;		// physical sector size
+  unsigned iomin;	// minimum I/O size (eg RAID chunk, 0 - unknown)
+  unsigned ioopt;	// optimal I/O size (eg RAID stripe, 0 - unknown)
+  unsigned dioalign;	// O_DIRECT offset/size alignment
+  unsigned diomem;	// O_DIRECT buffer alignment
+} geo;
+
+static void geominit(int fd, const struct stat *st) {
+  geo.lbs = 512;
+  geo.pbs = st->st_blksize;
+  if (S_ISBLK(st->st_mode)) {
+    int l;
+    if (ioctl(fd, BLKSSZGET, &l) == 0) geo.lbs = l;
+    if (ioctl(fd, BLKPBSZGET, &geo.pbs) < 0) geo.pbs = geo.lbs;
+    ioctl(fd, BLKIOMIN, &geo.iomin);
+    ioctl(fd, BLKIOOPT, &geo.ioopt);
+    geo.dioalign = geo.lbs;
+  }
+#ifdef STATX_DIOALIGN
+  else {
+    struct statx x;
+    if (statx(fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &x) == 0 &&
+        (x.stx_mask & STATX_DIOALIGN) && x.stx_dio_offset_align) {
+      geo.dioalign = x.stx_dio_offset_align;
+      geo.diomem = x.stx_dio_mem_align;
+    }
+  }
+#endif
+  if (!geo.dioalign) geo.dioalign = geo.lbs;
+  if (!geo.diomem) geo.diomem = geo.dioalign;
+}
+
+/* block size which needs no read-modify-write anywhere below us: the
+ * optimal I/O size if the device has one, else the largest of physical
+ * sector, minimum I/O and (for direct I/O) alignment sizes */
+static unsigned geombs(void) {
+  unsigned b = geo.pbs;
+  if (geo.ioopt) return geo.ioopt;
+  if (b < geo.iomin) b = geo.iomin;
+  if ((oflags & O_DIRECT) && b < geo.dioalign) b = geo.dioalign;
+  return b ? b : 8192;
+}
+
+/* validate block size against geometry of target fn before starting */
+static void geomcheck(const char *fn, int wr) {
+  if (!bs)
+    bs = geombs();
+  if ((oflags & O_DIRECT) && bs % geo.dioalign) {
+    fprintf(stderr, "block size %u is not a multiple of direct I/O alignment %u"
+                    " for %s, try -b%u\n", bs, geo.dioalign, fn, geombs());
+    exit(1);
+  }
+  if ((oflags & O_DIRECT) && getpagesize() % geo.diomem) {
+    fprintf(stderr, "direct I/O buffer alignment %u is not supported\n",
+            geo.diomem);
+    exit(1);
+  }
+  if (wr && geo.pbs && bs % geo.pbs)
+    fprintf(stderr, "warning: block size %u is not a multiple of physical"
+                    " sector %u, writes will need read-modify-write;"
+                    " try -b%u\n", bs, geo.pbs, geombs());
+}
+
+static void pgeom(FILE *f) {
+  fprintf(f, " geom lbs %u pbs %u iomin %u ioopt %u dio %u/%u bs %u\n",
+          geo.lbs, geo.pbs, geo.iomin, geo.ioopt, geo.dioalign, geo.diomem, bs);
+}
+
+/* Page cache control.  Buffered results depend on what is cached before
+ * the run, so allow dropping the target's pages first (-e), giving the
+ * kernel access pattern advice (-a), and measuring residency (-c). */
+static int evict;		// drop cached pages of the target before the run
+static int fadv = -1;		// fadvise advice for workers, -1 none, -2 by mode
+static int resid;		// measure page cache residency before/after
+static const struct { const char *name; int adv; } fadvs[] = {
+  { "normal", POSIX_FADV_NORMAL }, { "random", POSIX_FADV_RANDOM },
+  { "sequential", POSIX_FADV_SEQUENTIAL }, { "noreuse", POSIX_FADV_NOREUSE },
+  { "auto", -2 },
+};
+
+static int parseadv(const char *a) {
+  unsigned i;
+  for(i = 0; i < sizeof(fadvs)/sizeof(fadvs[0]); ++i)
+    if (strcmp(a, fadvs[i].name) == 0)
+      return fadvs[i].adv;
+  fprintf(stderr, "unknown fadvise advice `%s'\n", a);
+  exit(1);
+}
+
+/* fraction of the first sz bytes of fd resident in page cache.
+ * Mapped and checked with mincore() a chunk at a time. */
+static double cacheres(int fd, unsigned long long sz) {
+  const unsigned long long cs = 1ULL << 30;
+  long ps = getpagesize();
+  unsigned long long o, np = 0, nr = 0;
+  unsigned char *v = malloc(cs / ps);
+  if (!v || !sz) { free(v); return 0; }
+  for(o = 0; o < sz; o += cs) {
+    size_t l = sz - o < cs ? sz - o : cs, i;
+    void *m = mmap(NULL, l, PROT_READ, MAP_SHARED, fd, o);
+    if (m == MAP_FAILED) break;
+    if (mincore(m, l, v) == 0)
+      for(i = 0; i < (l + ps - 1) / ps; ++i)
+        nr += v[i] & 1;
+    np += (l + ps - 1) / ps;
+    munmap(m, l);
+  }
+  free(v);
+  return np ? (double)nr / np : 0;
+}
+
+static void decnr() {
+  pthread_mutex_lock(&rnmtx);
+  --running;
+  pthread_mutex_unlock(&rnmtx);
+  pthread_cond_broadcast(&rncond);
+}
+
+static volatile int term;
+
+/* Load phases (-G): the total rate of the paced threads over time, as a
+ * list of phases holding a rate, ramping it linearly, or bursting to a
+ * higher rate for bl every per.  A rate curve file becomes ramps between
+ * its points.  Rate -1 is unlimited, 0 is idle. */
+static struct phase {
+  char name[16];
+  unsigned long long t0, len;	// start and length, ns
+  double r0, r1;		// rate at start and end, or base and burst
+  unsigned long long per, bl;	// burst period and length, 0 - none
+} *phs;
+static unsigned nph;
+static unsigned long long phlen;	// schedule length, ns
+static unsigned nphthr;		// threads paced by it
+static unsigned long long phns0;	// run start (ns), the schedule origin
+
+static void phadd(const char *name, unsigned long long len, double r0,
+                  double r1, unsigned long long per, unsigned long long bl) {
+  struct phase *p;
+  if (!(nph & (nph + 1)) &&
+      !(phs = realloc(phs, (nph * 2 + 1) * sizeof(*phs))))
+    edie("phases");
+  p = &phs[nph++];
+  if (name) snprintf(p->name, sizeof(p->name), "%s", name);
+  else snprintf(p->name, sizeof(p->name), "p%u", nph);
+  p->t0 = phlen;
+  p->len = len;
+  p->r0 = r0;
+  p->r1 = r1;
+  p->per = per;
+  p->bl = bl;
+  phlen += len;
+}
+
+static double parserate(const char *a) {
+  return strcmp(a, "max") == 0 ? -1 : (double)parsesz(a);
+}
+
+/* rate curve file: "sec rate [name]" lines, times ascending */
+static void phfile(const char *path) {
+  char l[256], nm[16], pn[16] = "curve";
+  double t, pt = 0, pr = 0;
+  unsigned n = 0, ln = 0;
+  FILE *f = fopen(path, "r");
+  if (!f) edie(path);
+  while(fgets(l, sizeof(l), f)) {
+    char r[32];
+    int k;
+    ++ln;
+    if (l[strspn(l, " \t")] == '#' || strspn(l, " \t\r\n") == strlen(l))
+      continue;
+    if ((k = sscanf(l, "%lf %31s %15s", &t, r, nm)) < 2 || t < pt) {
+      fprintf(stderr, "%s:%u: invalid rate curve point\n", path, ln);
+      exit(1);
+    }
+    if (n++)
+      phadd(pn, (t - pt) * 1e9, pr, parserate(r), 0, 0);
+    if (k == 3) memcpy(pn, nm, sizeof(pn));
+    pt = t;
+    pr = parserate(r);
+  }
+  fclose(f);
+}
+
+/* parse -G: [name=]time@rate[~rate2|/burst:period:len],... or @file */
+static void parseph(char *a) {
+  char *p, *q, *r, *n;
+  if (*a == '@')
+    phfile(a + 1);
+  else for(p = strtok(a, ","); p; p = strtok(NULL, ",")) {
+    unsigned long long len;
+    n = NULL;
+    if ((q = strchr(p, '='))) {
+      *q = '\0';
+      n = p;
+      p = q + 1;
+    }
+    if (!(r = strchr(p, '@'))) {
+      fprintf(stderr, "-G: invalid phase `%s'\n", p);
+      exit(1);
+    }
+    *r++ = '\0';
+    len = parsetm(p);
+    if ((q = strchr(r, '/'))) {
+      char *c = strchr(q + 1, ':'), *c2 = c ? strchr(c + 1, ':') : NULL;
+      if (!c2) {
+        fprintf(stderr, "-G: burst needs base/burst:period:len\n");
+        exit(1);
+      }
+      *q++ = *c++ = *c2++ = '\0';
+      phadd(n, len, parserate(r), parserate(q), parsetm(c), parsetm(c2));
+      if (!phs[nph - 1].per) phs[nph - 1].per = 1;
+    }
+    else if ((q = strchr(r, '~'))) {
+      *q++ = '\0';
+      phadd(n, len, parserate(r), parserate(q), 0, 0);
+    }
+    else
+      phadd(n, len, parserate(r), parserate(r), 0, 0);
+  }
+  if (!phlen) {
+    fprintf(stderr, "-G: empty phase schedule\n");
+    exit(1);
+  }
+}
+
+/* total rate of the schedule t ns into the run; *cur is the phase
+ * cursor of the caller, *seg tells phases and bursts within them apart */
+static double phrate(unsigned *cur, unsigned long long t, unsigned *seg) {
+  const struct phase *p;
+  t %= phlen;
+  if (t < phs[*cur].t0) *cur = 0;		// schedule repeats
+  while(*cur + 1 < nph && t >= phs[*cur].t0 + phs[*cur].len) ++*cur;
+  p = &phs[*cur];
+  *seg = *cur * 2;
+  if (p->per) {
+    if ((t - p->t0) % p->per < p->bl) {
+      ++*seg;
+      return p->r1;
+    }
+    return p->r0;
+  }
+  if (p->r0 < 0 || p->r1 < 0) return -1;
+  return p->r0 + (p->r1 - p->r0) * (t - p->t0) / p->len;
+}
+
+/* pace the thread at its share of the schedule's rate; a phase (or
+ * burst) does not make up for what the previous one fell behind.
+ * Returns 0 if the deadline passed, or the run was interrupted, while
+ * waiting. */
+static int phpace(struct state *s) {
+  unsigned long long now = nsnow();
+  unsigned seg;
+  double r = phrate(&s->ph, now - phns0, &seg);
+  while(r == 0) {		// idle
+    struct timespec ts = { 0, 1000000 };
+    if (term || (s->dl && ticks() >= s->dl)) return 0;
+    nanosleep(&ts, NULL);
+    now = nsnow();
+    r = phrate(&s->ph, now - phns0, &seg);
+  }
+  if (seg != s->phseg) {
+    s->phseg = seg;
+    if (s->pdue < now) s->pdue = now;
+  }
+  if (r < 0) s->pdue = now;
+  else s->pdue += (s->ioby - s->pby) / (r / nphthr) * 1e9;
+  s->pby = s->ioby;
+  return sleepdl(s, s->pdue);
+}
+
+static inline void cpurelax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  __asm__ __volatile__("pause");
+#endif
+}
+
+/* wait until tick e: sleep while more than spinns is left, then spin.
+ * Sleeps are cut into slices of at most 10ms to notice interruption.
+ * Returns the tick the wait ended. */
+static tick_t twait(tick_t e) {
+  tick_t t = ticks();
+  double l;
+  while(t < e && !term && (l = tk2ns(e - t)) > spinns) {
+    unsigned long long ns = l - spinns < 10000000 ? l - spinns : 10000000;
+    struct timespec ts = { 0, ns };
+    nanosleep(&ts, NULL);
+    t = ticks();
+  }
+  while(t < e && !term)
+    cpurelax(), t = ticks();
+  return t;
+}
+
+/* think after an I/O completed at t.  Returns the time thinking ended. */
+static tick_t think(struct state *s, tick_t t) {
+  const struct think *k = s->thk;
+  unsigned long long ns;
+  tick_t e;
+  switch(k->kind) {
+  case THexp: ns = -log(1 - drand48()) * k->a; break;
+  case THuni: ns = k->a + (k->b - k->a) * drand48(); break;
+  case THemp: ns = k->v[lrand48() % k->n]; break;
+  default: ns = k->a;
+  }
+  if (s->dl && t + ns2tk(ns) > s->dl)	// not past the deadline
+    ns = s->dl > t ? tk2ns(s->dl - t) : 0;
+  e = twait(t + ns2tk(ns));
+  s->thsum += e - t;
+  s->thask += ns;
+  ++s->thn;
+  return e;
+}
+
+/* think time asked for and got, per mode */
+static void pthk(FILE *f) {
+  unsigned long long a[NM] = { 0 }, n[NM] = { 0 };
+  tick_t g[NM] = { 0 };
+  unsigned i;
+  for(i = 0; i < ntt; ++i) {
+    a[states[i].opi] += states[i].thask;
+    g[states[i].opi] += states[i].thsum;
+    n[states[i].opi] += states[i].thn;
+  }
+  for(i = 0; i < NM; ++i)
+    if (n[i])
+      fprintf(f, " %s think %.3fus avg, asked %.3fus, %llu waits\n",
+              ion[i], tk2ns(g[i]) / n[i] / 1e3, a[i] / 1e3 / n[i], n[i]);
+}
+
+/* Write-ahead log (-L): writers append variable size records to a shared
+ * log buffer; one of them becomes the leader and writes out everything
+ * appended so far with a single write and fdatasync, while the records
+ * arriving meanwhile collect in the other buffer for the next commit.
+ * The leader may wait gcdelay first to let more records in, and a commit
+ * never exceeds gcmax bytes (0 - one record per commit, no grouping).
+ * Files are appended to at their end; devices are written from the
+ * start and wrapped around. */
+static unsigned walmin = 128, walmax = 4096;	// record size range
+static unsigned long long gcdelay;	// leader's wait for more records, ns
+static size_t gcmax = 1 << 20;		// max commit size
+#define WALNC 16
+static struct wal {
+  pthread_mutex_t mtx;
+  pthread_cond_t cond;
+  char *b[2];			// fill and write buffers
+  unsigned cur;			// index of the fill buffer
+  size_t fill;			// bytes in the fill buffer
+  unsigned long long lsn;	// end of the last appended record
+  unsigned long long dlsn;	// durable up to here
+  int busy;			// a leader is writing
+  int err;			// write failed, stop
+  off_t off, end;		// next write offset, end of log area (0 - file)
+  unsigned long long ncommit, nbytes;	// commits done, bytes written
+  unsigned long long nstart;	// commits started: next one's number
+  off_t coff[WALNC];		// offsets of the last WALNC commits
+} wal = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+static void walinit(void) {
+  size_t sz = (gcmax > walmax ? gcmax : walmax) + geo.dioalign;
+  struct stat st;
+  unsigned i;
+  for(i = 0; i < 2; ++i)
+    if (!wal.b[i] && posix_memalign((void **)&wal.b[i], 4096, sz))
+      edie("posix_memalign");
+  wal.cur = wal.fill = wal.busy = wal.err = 0;
+  wal.lsn = wal.dlsn = wal.ncommit = wal.nbytes = wal.nstart = 0;
+  if (stat(fn, &st) == 0 && S_ISREG(st.st_mode)) {
+    wal.off = st.st_size;
+    wal.end = 0;
+  }
+  else {
+    wal.off = 0;
+    wal.end = tgsz;
+  }
+  if (oflags & O_DIRECT)
+    wal.off = (wal.off + geo.dioalign - 1) / geo.dioalign * geo.dioalign;
+}
+
+/* write out the fill buffer as leader.  Called, and returns, with
+ * wal.mtx held and !wal.busy. */
+static void walcommit(struct state *s) {
+  char *b;
+  size_t n;
+  off_t o;
+  unsigned long long e, k;
+  int r;
+  wal.busy = 1;
+  if (gcdelay) {
+    struct timespec ts = { gcdelay / 1000000000, gcdelay % 1000000000 };
+    pthread_mutex_unlock(&wal.mtx);
+    nanosleep(&ts, NULL);
+    pthread_mutex_lock(&wal.mtx);
+  }
+  b = wal.b[wal.cur];
+  n = wal.fill;
+  e = wal.lsn;
+  k = wal.nstart++;
+  wal.cur ^= 1;
+  wal.fill = 0;
+  if (oflags & O_DIRECT) {	// pad to sector, as real logs do
+    size_t a = (n + geo.dioalign - 1) / geo.dioalign * geo.dioalign;
+    memset(b + n, 0, a - n);
+    n = a;
+  }
+  if (wal.end && wal.off + (off_t)n > wal.end)
+    wal.off = 0;
+  o = wal.coff[k % WALNC] = wal.off;
+  wal.off += n;
+  pthread_mutex_unlock(&wal.mtx);
+  r = pwrite(s->fd, b, n, o) == (ssize_t)n ? 0 : -1;
+  if (!r)
+    r = fsm == FSfsync ? fsync(s->fd) : fdatasync(s->fd);
+  pthread_mutex_lock(&wal.mtx);
+  if (r < 0) {
+    perror("log write");
+    wal.err = 1;
+  }
+  ++wal.ncommit;
+  wal.nbytes += n;
+  wal.dlsn = e;
+  wal.busy = 0;
+  pthread_cond_broadcast(&wal.cond);
+}
+
+/* append a record of len bytes and wait until it is durable; s->loff
+ * gets where it went in the log, its commit's offset plus its place in
+ * the buffer.  The fill buffer goes out with the next commit started. */
+static int walwrite(struct state *s, unsigned len) {
+  unsigned long long my, cn;
+  size_t pos;
+  pthread_mutex_lock(&wal.mtx);
+  while (wal.fill && wal.fill + len > gcmax && !wal.err) {
+    if (!wal.busy) walcommit(s);
+    else pthread_cond_wait(&wal.cond, &wal.mtx);
+  }
+  memset(wal.b[wal.cur] + wal.fill, s->i, len);
+  pos = wal.fill;
+  cn = wal.nstart;
+  wal.fill += len;
+  my = wal.lsn += len;
+  while (wal.dlsn < my && !wal.err) {
+    if (!wal.busy) walcommit(s);
+    else pthread_cond_wait(&wal.cond, &wal.mtx);
+  }
+  s->loff = wal.coff[cn % WALNC] + pos;
+  pthread_mutex_unlock(&wal.mtx);
+  if (wal.err) {
+    errno = EIO;
+    return -1;
+  }
+  return len;
+}
+
+static unsigned walrecsz(struct state *s) {
+  s = s;
+  return walmin + lrand48() % (walmax - walmin + 1);
+}
+
+static void pwal(FILE *f) {
+  unsigned long long c = 0;
+  tick_t t0 = 0, t1 = 0;
+  unsigned i;
+  if (!wal.ncommit) return;
+  for(i = 0; i < ntt; ++i)
+    if (states[i].opi == LogWr) {
+      c += states[i].ioc;
+      if (!t0 || states[i].stime < t0) t0 = states[i].stime;
+      if (states[i].etime > t1) t1 = states[i].etime;
+    }
+  fprintf(f, " LogWr %llu records, %.0f records/s, commits %llu,"
+             " %.1f records and %.0f bytes per commit\n",
+          c, t1 > t0 ? c / (tk2ns(t1 - t0) / 1e9) : 0, wal.ncommit,
+          (double)c / wal.ncommit, (double)wal.nbytes / wal.ncommit);
+}
+
+/* Precomputed positions (-x): nsch values per thread, lo + r % m with
+ * r drawn by nrand48() seeded with the thread number, for the threads
+ * whose positions are random (m = 0 for the others).  With a file the
+ * values live there after a header with the (lo, m) of every thread, so
+ * they are generated only when the file is missing or does not match. */
+#define SCHMAGIC "IOTSCH1\n"
+static unsigned nsch;		// positions per thread, 0 - none
+static const char *schfn;	// file to keep them in
+static unsigned *sched;		// ntt * nsch positions
+static unsigned *schlm;		// lo, m of each thread
+
+static unsigned schpos(struct state *s) {
+  if (s->schi == nsch) s->schi = 0;
+  return s->sch[s->schi++];
+}
+
+/* set lo, m of thread k doing mode opi of job (+1, 0 - none) */
+static void schrange(unsigned k, unsigned opi, unsigned job) {
+  unsigned *lm = schlm + 2 * k;
+  lm[0] = lm[1] = 0;
+  if (opi == LogWr) {
+    lm[0] = walmin;
+    lm[1] = walmax - walmin + 1;
+  }
+  else if (job && (mfl[opi] & MFrnd)) {
+    unsigned sz = jobs[job - 1].iosz ? jobs[job - 1].iosz : bs;
+    lm[1] = tgs[jobs[job - 1].tg].sz / sz;
+  }
+  else if (opi == LsmRd)
+    lm[1] = (unsigned long long)bc * bs / msz[LsmRd];
+  else if (!job && (opi == RndRd || opi == RndWr || opi == RmwUp))
+    lm[1] = bc;
+}
+
+/* compute the ranges, map or allocate the positions, and draw them
+ * unless the file already has them */
+static void schinit(void) {
+  size_t hl = 8 + 2 * sizeof(unsigned) + (size_t)ntt * 2 * sizeof(unsigned);
+  size_t len = hl + (size_t)ntt * nsch * sizeof(unsigned);
+  unsigned i, j, k = 0, gen = 1;
+  char *m = NULL;
+  int fd = -1;
+  struct stat st;
+  if (!(schlm = calloc(ntt, 2 * sizeof(unsigned)))) edie("positions");
+  for(j = 0; j < NM; ++j)
+    for(i = 0; i < nt[j]; ++i)
+      schrange(k++, j, 0);
+  for(j = 0; j < njob; ++j)
+    for(i = 0; i < jobs[j].nt; ++i)
+      schrange(k++, jobs[j].opi, j + 1);
+  if (schfn) {
+    if ((fd = open(schfn, O_RDWR|O_CREAT, 0666)) < 0 || fstat(fd, &st) < 0)
+      edie(schfn);
+    if ((size_t)st.st_size != len && ftruncate(fd, len) < 0)
+      edie(schfn);
+    m = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (m == MAP_FAILED) edie(schfn);
+    close(fd);
+    gen = (size_t)st.st_size != len || memcmp(m, SCHMAGIC, 8) ||
+          ((unsigned *)(m + 8))[0] != ntt || ((unsigned *)(m + 8))[1] != nsch ||
+          memcmp(m + 8 + 2 * sizeof(unsigned), schlm, hl - 8 - 2 * sizeof(unsigned));
+    sched = (unsigned *)(m + hl);
+  }
+  else if (!(sched = malloc((size_t)ntt * nsch * sizeof(unsigned))))
+    edie("positions");
+  if (!gen) {
+    fprintf(stderr, "%s: reusing precomputed positions\n", schfn);
+    return;
+  }
+  for(k = 0; k < ntt; ++k) {
+    unsigned short xs[3] = { 0x330e, k, k >> 16 };
+    unsigned *p = sched + (size_t)k * nsch;
+    if (!schlm[2 * k + 1]) continue;
+    for(i = 0; i < nsch; ++i)
+      p[i] = schlm[2 * k] + nrand48(xs) % schlm[2 * k + 1];
+  }
+  if (m) {
+    memcpy(m, SCHMAGIC, 8);
+    ((unsigned *)(m + 8))[0] = ntt;
+    ((unsigned *)(m + 8))[1] = nsch;
+    memcpy(m + 8 + 2 * sizeof(unsigned), schlm, hl - 8 - 2 * sizeof(unsigned));
+    msync(m, len, MS_ASYNC);
+  }
+}
+
+/* claim a chunk of blocks from the global budget (gbm).  Threads take
+ * GBCHUNK blocks at a time so the shared counter is touched rarely; the
+ * last chunk is trimmed so the total is exact.  Returns 0 when exhausted. */
+#define GBCHUNK 16
+static unsigned gbclaim(void) {
+  unsigned long long c = __sync_fetch_and_add(&gbc, GBCHUNK);
+  if (c >= gbm) return 0;
+  return gbm - c < GBCHUNK ? gbm - c : GBCHUNK;
+}
+
+/* Trace replay (-F): reissue the I/O of a trace, in text (lines of
+ * "time-sec op offset length [stream]", op being R, W or F for flush) or
+ * binary (TRMAGIC, then struct trec) format, with the original timing,
+ * scaled by trspeed, or as fast as possible (trspeed 0).  The trace is
+ * memory mapped and streamed through, so it needs not fit in memory.
+ * Records of stream n go to worker n % workers, so each stream's order
+ * is kept; text records without a stream are dealt out round-robin.  The
+ * trace is parsed once, whatever the number of workers. */
+static const char *trfn;	// trace file
+static const char *trmap;	// the mapped trace
+static size_t trlen;
+static int trbin;		// binary format
+static double trspeed = 1;	// timing scale, 0 - as fast as possible
+static unsigned long long trts0;	// first record's time
+
+/* parse text trace line [p, e).  Returns 1 if it is a record (strm -1
+ * if none given), 0 for comments and blank lines, -1 if invalid. */
+static int trparse(const char *p, const char *e, struct trec *r, int *strm) {
+  char l[256], *q, *x;
+  double t;
+  if (e - p >= (long)sizeof(l)) return -1;
+  memcpy(l, p, e - p);
+  l[e - p] = '\0';
+  q = l + strspn(l, " \t");
+  if (!*q || *q == '#' || *q == '\r') return 0;
+  t = strtod(q, &x);
+  if (x == q) return -1;
+  r->ts = t * 1e9;
+  q = x + strspn(x, " \t");
+  switch(*q) {
+  case 'R': case 'r': r->op = TRrd; break;
+  case 'W': case 'w': r->op = TRwr; break;
+  case 'F': case 'f': r->op = TRfl; break;
+  default: return -1;
+  }
+  q += strcspn(q, " \t");
+  r->off = strtoull(q, &x, 0);
+  if (x == q && r->op != TRfl) return -1;
+  r->len = strtoul(q = x, &x, 0);
+  if (x == q && r->op != TRfl) return -1;
+  *strm = strtol(q = x, &x, 0);
+  if (x == q) *strm = -1;
+  return 1;
+}
+
+/* parse the record at *pos on, advancing past it.  Returns 0 at the end
+ * of the trace; invalid records are skipped, complaining if say. */
+static int trread(size_t *pos, struct trec *r, int *strm, int say) {
+  while(*pos < trlen) {
+    if (trbin) {
+      if (*pos + sizeof(*r) > trlen) break;
+      memcpy(r, trmap + *pos, sizeof(*r));
+      *pos += sizeof(*r);
+      *strm = r->strm;
+      return 1;
+    }
+    else {
+      const char *p = trmap + *pos;
+      const char *e = memchr(p, '\n', trlen - *pos);
+      if (!e) e = trmap + trlen;
+      *pos = e - trmap + 1;
+      switch(trparse(p, e, r, strm)) {
+      case 1: return 1;
+      case -1:
+        if (say)
+          fprintf(stderr, "%s: invalid record `%.*s'\n", trfn, (int)(e - p), p);
+      }
+    }
+  }
+  return 0;
+}
+
+/* The trace is parsed once, by one worker at a time: the one that finds
+ * its queue empty parses on, dealing records out to the queues of their
+ * workers (waiting for room in a full one), until it has one itself. */
+#define TRQ 64
+static struct trq {
+  struct trec r[TRQ];
+  unsigned h, t;	// next to take, next free
+  int gone;		// worker finished, its records are dropped
+} *trqs;
+static size_t trcur;		// parse position
+static unsigned long long tridx;	// records without a stream dealt
+static int trbusy, treof;	// a worker is parsing, trace parsed
+static pthread_mutex_t trmtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t trcond = PTHREAD_COND_INITIALIZER;
 
-static void edie(const char *what) {
-  fprintf(stderr, "%s: %m \n", what);
-  exit(1);
+/* get next record of this worker's streams, 0 at end of trace */
+static int trnext(struct state *s, struct trec *r) {
+  struct trq *q = &trqs[s->i], *d;
+  struct trec t;
+  int strm, got;
+  pthread_mutex_lock(&trmtx);
+  for(;;) {
+    if ((got = q->h != q->t)) {
+      if (q->t - q->h == TRQ)	// the parser may wait for room
+        pthread_cond_broadcast(&trcond);
+      *r = q->r[q->h++ % TRQ];
+      break;
+    }
+    if (treof) break;
+    if (trbusy) {
+      pthread_cond_wait(&trcond, &trmtx);
+      continue;
+    }
+    trbusy = 1;
+    while(q->h == q->t && !term) {
+      if (!trread(&trcur, &t, &strm, 1)) {
+        treof = 1;
+        break;
+      }
+      d = &trqs[(strm < 0 ? tridx++ : (unsigned)strm) % nt[Replay]];
+      while(d->t - d->h == TRQ && !d->gone && !term)
+        pthread_cond_wait(&trcond, &trmtx);
+      if (d->gone || d->t - d->h == TRQ) continue;
+      if (d->h == d->t)		// its worker may wait for it
+        pthread_cond_broadcast(&trcond);
+      d->r[d->t++ % TRQ] = t;
+    }
+    trbusy = 0;
+    pthread_cond_broadcast(&trcond);
+    if (term) break;
+  }
+  pthread_mutex_unlock(&trmtx);
+  return got;
 }
 
-#ifdef USE_DEV_URANDOM
-static int randfd;
-#endif
-static int oflags;		// open flags
-static char *fn;		// filename
-static unsigned bs = 8192;	// block size
-static unsigned bc;		// block count (device size in blocks)
-static unsigned bm;		// blocks to do
+/* worker done replaying: stop dealing records to it */
+static void trdone(struct state *s) {
+  pthread_mutex_lock(&trmtx);
+  trqs[s->i].gone = 1;
+  pthread_cond_broadcast(&trcond);
+  pthread_mutex_unlock(&trmtx);
+}
 
-#define MFrnd   1
-#define MFwrt   2
-#define LinRd	0
-#define RndRd	MFrnd
-#define LinWr	MFwrt
-#define RndWr	(MFrnd|MFwrt)
+/* rewind the replay for a run */
+static void trreset(void) {
+  if (!trqs && !(trqs = malloc(nt[Replay] * sizeof(*trqs))))
+    edie("trace queues");
+  memset(trqs, 0, nt[Replay] * sizeof(*trqs));
+  trcur = trbin ? 8 : 0;
+  tridx = 0;
+  trbusy = treof = 0;
+}
 
-struct state {
-  int fd;
-  char *buf;
-  unsigned ioc;		// I/O count
-  int (*workfn)(struct state *, unsigned blocknr);
-  unsigned (*posfn)(struct state *s);
-  unsigned opi;		// operation index
-  unsigned i;		// curidx
-  double stime;		// start time
-  unsigned bn;		// current block number for linear i/o
-};
+/* fetch the next record and wait for its time */
+static unsigned trpos(struct state *s) {
+  if (!trnext(s, &s->tr)) {
+    s->eot = 1;
+    return 0;
+  }
+  if (trspeed && !sleepdl(s, s->pns + (s->tr.ts - trts0) / trspeed))
+    s->eot = 1;		// deadline passed waiting for it
+  return 0;
+}
 
-static unsigned tioc;	// total i/o count
-static struct state *states;
-static unsigned nt[4];
-static unsigned ntt;
-static volatile unsigned running;
-static const char *const ion[4] = { "LinRd", "RndRd", "LinWr", "RndWr" };
+static int wreplay(struct state *s, unsigned b) {
+  struct trec *r = &s->tr;
+  unsigned long long sz = tgsz, o = r->off;
+  tick_t t0 = ticks();
+  int n;
+  if (r->op == TRfl) {
+    n = fdatasync(s->fd);
+    hadd(&s->fh, ticks() - t0);
+    ++s->fsc;
+    return n;
+  }
+  if (r->len > s->bcap) {
+    free(s->rbuf);
+    if (posix_memalign((void **)&s->rbuf, 4096, r->len)) {
+      s->rbuf = NULL;
+      errno = ENOMEM;
+      return -1;
+    }
+    s->buf = s->rbuf;
+    s->bcap = r->len;
+  }
+  if (sz && o + r->len > sz) {	// wrap around the end of target
+    o = r->len < sz ? o % (sz - r->len + 1) : 0;
+    o -= o % geo.dioalign;
+  }
+  n = r->op == TRwr ? pwrite(s->fd, s->buf, r->len, o)
+                    : pread(s->fd, s->buf, r->len, o);
+  hadd(r->op == TRwr ? &s->wh : &s->rh, ticks() - t0);
+  b = b;
+  return n;
+}
 
-static pthread_mutex_t rnmtx = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t rncond = PTHREAD_COND_INITIALIZER;
+/* map the trace and find its format and start time */
+static void trinit(void) {
+  struct trec r;
+  size_t pos;
+  int fd = open(trfn, O_RDONLY), strm;
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0) edie(trfn);
+  trlen = st.st_size;
+  trmap = trlen ? mmap(NULL, trlen, PROT_READ, MAP_SHARED, fd, 0) : "";
+  if (trmap == MAP_FAILED) edie(trfn);
+  close(fd);
+  madvise((void *)trmap, trlen, MADV_SEQUENTIAL);
+  trbin = trlen >= 8 && memcmp(trmap, TRMAGIC, 8) == 0;
+  pos = trbin ? 8 : 0;
+  if (trread(&pos, &r, &strm, 0))
+    trts0 = r.ts;
+}
+
+static FILE *trof;		// trace being recorded
+static tick_t trt0;		// recording time origin
 
-static double curtime(void) {
-  struct timeval tv;
-  gettimeofday(&tv, NULL);
-  return tv.tv_sec + tv.tv_usec / 1000000.0;
+/* describe I/O of block b which transferred n bytes */
+static inline void ioinfo(struct state *s, unsigned b, int n, struct tent *e) {
+  if (s->opi == Replay) {
+    e->off = s->tr.off;
+    e->len = s->tr.len;
+    e->op = s->tr.op;
+  }
+  else {
+    e->off = s->opi == LogWr ? s->loff : (unsigned long long)b * s->iosz;
+    e->len = n;
+    e->op = mfl[s->opi] & MFwrt ? TRwr : TRrd;
+  }
 }
 
-static unsigned randpos(struct state *s) {
-  unsigned n;
-#ifdef USE_DEV_URANDOM
-  read(randfd, &n, sizeof(n));
-#else
-  n = lrand48();
-#endif
-  s = s;
-  return n % bc;
+static inline void trrec(struct state *s, unsigned b, int n,
+                         tick_t t0, tick_t t1) {
+  unsigned h = s->rhead;
+  struct tent *e;
+  if (h - __atomic_load_n(&s->rtail, __ATOMIC_ACQUIRE) >= TRING) {
+    ++s->rdrop;
+    return;
+  }
+  e = &s->ring[h & (TRING - 1)];
+  e->t0 = t0;
+  e->t1 = t1;
+  ioinfo(s, b, n, e);
+  __atomic_store_n(&s->rhead, h + 1, __ATOMIC_RELEASE);
 }
 
-static unsigned linpos(struct state *s) {
-  if (s->bn >= bc)
-    s->bn = 0;
-  return s->bn++;
+/* keep the I/O if it is among the nslow slowest of the thread */
+static void slowrec(struct state *s, unsigned b, int n, tick_t t0, tick_t t1) {
+  struct slow *h = s->slow, x;
+  unsigned i = 0, c;
+  if (s->nsl == nslow && t1 - t0 <= h[0].e.t1 - h[0].e.t0)
+    return;
+  x.e.t0 = t0;
+  x.e.t1 = t1;
+  ioinfo(s, b, n, &x.e);
+  for(x.infl = 1, i = 0; i < ntt; ++i)
+    x.infl += __atomic_load_n(&states[i].busy, __ATOMIC_RELAXED);
+  i = 0;
+  x.opi = s->opi;
+  x.thr = s->i;
+  x.tg = s->tgc;
+  if (s->nsl < nslow) {		// sift up
+    for(i = s->nsl++; i; i = c) {
+      c = (i - 1) / 2;
+      if (h[c].e.t1 - h[c].e.t0 <= t1 - t0) break;
+      h[i] = h[c];
+    }
+    h[i] = x;
+    return;
+  }
+  for(;;) {			// replace root, sift down
+    c = 2 * i + 1;
+    if (c >= nslow) break;
+    if (c + 1 < nslow && h[c + 1].e.t1 - h[c + 1].e.t0 < h[c].e.t1 - h[c].e.t0)
+      ++c;
+    if (t1 - t0 <= h[c].e.t1 - h[c].e.t0) break;
+    h[i] = h[c];
+    i = c;
+  }
+  h[i] = x;
 }
 
-static int wwriter(struct state *s, unsigned b) {
-  return pwrite(s->fd, s->buf, bs, (off_t)b * bs);
+static int slowcmp(const void *a, const void *b) {
+  const struct slow *x = a, *y = b;
+  tick_t lx = x->e.t1 - x->e.t0, ly = y->e.t1 - y->e.t0;
+  return lx < ly ? 1 : lx > ly ? -1 : 0;
 }
-static int wreader(struct state *s, unsigned b) {
-  return pread(s->fd, s->buf, bs, (off_t)b * bs);
+
+/* print the nslow slowest I/Os of the run, t0 - run start */
+static void pslow(FILE *f, tick_t t0) {
+  static const char *const opn[] = { "read", "write", "flush" };
+  struct slow *a;
+  unsigned i, j, n = 0;
+  if (!nslow || !(a = malloc((size_t)ntt * nslow * sizeof(*a)))) return;
+  for(i = 0; i < ntt; ++i)
+    for(j = 0; j < states[i].nsl; ++j)
+      a[n++] = states[i].slow[j];
+  qsort(a, n, sizeof(*a), slowcmp);
+  for(i = 0; i < n && i < nslow; ++i)
+    fprintf(f, " slow %u: %.1fus %s %s#%u%s%s off %llu len %u at %.6fs"
+               " inflight %u\n",
+            i + 1, tk2ns(a[i].e.t1 - a[i].e.t0) / 1e3, opn[a[i].e.op],
+            ion[a[i].opi], a[i].thr, ntg > 1 ? " on " : "",
+            ntg > 1 ? tgs[a[i].tg].fn : "", a[i].e.off, a[i].e.len,
+            tk2ns(a[i].e.t0 - t0) / 1e9, a[i].infl);
+  free(a);
 }
 
-static void pst(FILE *f) {
-  double ct = curtime();
-  double r[4] = { 0, 0, 0, 0 };
-  unsigned c[4] = { 0, 0, 0, 0 };
+/* move recorded entries of all workers to the trace file */
+static unsigned long long trdrain(void) {
+  unsigned long long n = 0;
   unsigned i;
-  double d;
   for(i = 0; i < ntt; ++i) {
-    d = ct - states[i].stime;
-    r[states[i].opi] += states[i].ioc / d;
-    c[states[i].opi] += states[i].ioc;
+    struct state *s = &states[i];
+    unsigned h = __atomic_load_n(&s->rhead, __ATOMIC_ACQUIRE), t;
+    for(t = s->rtail; t != h; ++t) {
+      const struct tent *e = &s->ring[t & (TRING - 1)];
+      struct trec r;
+      double l = tk2ns(e->t1 - e->t0);
+      memset(&r, 0, sizeof(r));
+      r.ts = tk2ns(e->t0 - trt0);
+      r.off = e->off;
+      r.len = e->len;
+      r.lat = l < 4e9 ? l : 4e9;
+      r.strm = i;
+      r.op = e->op;
+      fwrite(&r, sizeof(r), 1, trof);
+      ++n;
+    }
+    __atomic_store_n(&s->rtail, h, __ATOMIC_RELEASE);
   }
-//#if 1
-//  for(i = 0; i < 4; ++i)
-//    if (c[i])
-//      fprintf(f, " %s %u %.2f", ion[i], c[i], r[i] * bs / 1024 / 1024);
-//#endif
+  return n;
 }
 
-static void incc() {
-  if (!(++tioc % 1000))
-    pthread_cond_signal(&rncond);
-}
-static void decnr() {
-  pthread_mutex_lock(&rnmtx);
-  --running;
-  pthread_mutex_unlock(&rnmtx);
-  pthread_cond_broadcast(&rncond);
-}
+static int selfb;		// self-benchmark, no summaries or progress
 
-static volatile int term;
+/* recording thread: drain rings every 10ms (1ms for -B, whose single
+ * thread fills a ring in a few ms) until workers are done */
+static void *trwriter(void *arg) {
+  unsigned long long *n = arg;
+  struct timespec ts = { 0, selfb ? 1000000 : 10000000 };
+  while(running) {
+    *n += trdrain();
+    nanosleep(&ts, NULL);
+  }
+  *n += trdrain();
+  fflush(trof);
+  return 0;
+}
 
-void *worker(void *arg) {
-  struct state *s = arg;
-  s->workfn = s->opi & MFwrt ? wwriter : wreader;
-  s->posfn  = s->opi & MFrnd ? randpos : linpos;
-  s->fd = open(fn, (s->opi & MFwrt ? O_WRONLY : O_RDONLY) | oflags);
-  if (s->fd < 0) {
-    int e = errno;
-    decnr();
-    errno = e;
-    edie(fn);
-  }
-  s->stime = curtime();
+/* The I/O loop, from tick t1 on until done.  It is always inlined, so
+ * the instances below, which pass constant pos and work, get those
+ * inlined too instead of calling them through pointers per I/O. */
+static inline __attribute__((always_inline))
+void ioloop(struct state *s, tick_t t1, unsigned (*pos)(struct state *),
+            int (*work)(struct state *, unsigned)) {
+  unsigned gbl = 0;	// blocks left from claimed global budget chunk
+  unsigned b;
+  int r, wfl = fsm && fsm != FSdsync && s->opi != LogWr && s->opi != Replay &&
+               mfl[s->opi] & MFwrt;	// flush writes
+  tick_t t0;
   for(;;) {
     if (term) break;
-    if (s->workfn(s, s->posfn(s)) < 0) {
+    if (s->dl && t1 >= s->dl) break;
+    if (gbm) {
+      if (!gbl && !(gbl = gbclaim())) break;
+      --gbl;
+    }
+    if (s->php ? !phpace(s) : s->rate && !pace(s))
+      break;
+    b = pos(s);
+    if (s->eot) break;
+    if (s->tgm)
+      s->fd = s->tg[s->tgc = tgmap(s, &b)].fd;
+    if (nslow)
+      __atomic_store_n(&s->busy, 1, __ATOMIC_RELAXED);
+    t0 = ticks();
+    r = work(s, b);
+    t1 = ticks();
+    if (nslow)
+      __atomic_store_n(&s->busy, 0, __ATOMIC_RELAXED);
+    if (r < 0) {
       perror(ion[s->opi]);
       break;
     }
+    s->ioby += r;
+    s->lsum += t1 - t0;
+    if (s->lmax < t1 - t0) s->lmax = t1 - t0;
+    ++s->tg[s->tgc].ioc;
+    s->tg[s->tgc].ioby += r;
+    s->tg[s->tgc].lsum += t1 - t0;
+    hadd(&s->lh, t1 - t0);
+    if (s->ring)
+      trrec(s, b, r, t0, t1);
+    if (nslow)
+      slowrec(s, b, r, t0, t1);
+    if (wfl)
+      t1 = wflush(s, t1, b);
     ++s->ioc;
-    incc();
     if (bm && s->ioc >= bm) break;
+    if (s->thk)
+      t1 = think(s, t1);
+  }
+}
+
+/* Loop instances for the common (position, I/O) function pairs; other
+ * pairs run the generic one, calling through s->posfn and s->workfn. */
+#define LOOPS(X) \
+  X(linpos, wreader) X(linpos, wwriter) X(linpos, wdwriter) \
+  X(randpos, wreader) X(randpos, wwriter) X(randpos, wdwriter) \
+  X(randpos, wrmw) X(szlpos, wszread) X(szlpos, wszwrite) \
+  X(szrpos, wszread) X(szrpos, wszwrite) X(szlpos, wszdwrite) \
+  X(szrpos, wszdwrite) X(schpos, wreader) X(schpos, wwriter) \
+  X(schpos, wdwriter) X(schpos, wrmw) X(schpos, wszread) \
+  X(schpos, wszwrite) X(schpos, wszdwrite) X(linpos, wnull) \
+  X(randpos, wnull) X(szlpos, wnull) X(szrpos, wnull) X(schpos, wnull)
+#define X(p, w) \
+static void loop_##p##_##w(struct state *s, tick_t t) { ioloop(s, t, p, w); }
+LOOPS(X)
+#undef X
+
+static void loopgen(struct state *s, tick_t t) {
+  ioloop(s, t, s->posfn, s->workfn);
+}
+
+static const struct loop {
+  unsigned (*pos)(struct state *);
+  int (*work)(struct state *, unsigned);
+  void (*fn)(struct state *, tick_t);
+} loops[] = {
+#define X(p, w) { p, w, loop_##p##_##w },
+LOOPS(X)
+#undef X
+};
+
+static int genloop;		// always use the generic loop
+
+/* Data pattern (-f): what goes into write buffers */
+#define DPzero	-1
+#define DPrand	-2
+static int dpat = DPzero;	// or the byte value
+
+static int parsepat(const char *a) {
+  char *e;
+  long v;
+  if (strcmp(a, "zero") == 0) return DPzero;
+  if (strcmp(a, "rand") == 0) return DPrand;
+  v = strtol(a, &e, 0);
+  if (e == a || *e || v < 0 || v > 255) {
+    fprintf(stderr, "invalid data pattern `%s'\n", a);
+    exit(1);
+  }
+  return v;
+}
+
+/* fill b with the data pattern, seed selecting the random sequence */
+static void fillpat(char *b, size_t n, unsigned long long seed) {
+  unsigned long long x = seed * 0x9e3779b97f4a7c15ULL + 1, *p;
+  if (dpat != DPrand) {
+    memset(b, dpat == DPzero ? 0 : dpat, n);
+    return;
+  }
+  for(p = (unsigned long long *)b; n >= sizeof(*p); n -= sizeof(*p)) {
+    x ^= x << 13;		// xorshift64
+    x ^= x >> 7;
+    x ^= x << 17;
+    *p++ = x;
+  }
+}
+
+/* Preconditioning (-D): before the measured run every target is written
+ * sequentially from end to end, then overwritten at random bs blocks in
+ * PCROUND rounds until the write rate settles: over the last PCWIN rounds
+ * its range is at most 20% of the average, and the fitted slope moves it
+ * at most 10% over the window (the SNIA PTS steady state rule), or until
+ * pcmax times the capacity has been overwritten.  Fill helper threads and
+ * all the workers, on their own fds, do it; the workers then go straight
+ * into the measured run. */
+#define MKCHUNK (1 << 20)
+#define PCROUND 1000000000ULL	// ns
+#define PCWIN 5
+static int pcond;		// precondition the targets
+static double pcmax;		// overwrite limit, times capacity, 0 - none
+static unsigned pcthr;		// helper threads
+static volatile int pcstop;	// random overwrites done
+static unsigned long long pcfby, pcrby;	// bytes written by fill, overwrites
+static unsigned long long pcfill, pctot;	// bytes to fill, overwrite
+static unsigned pcpark;		// workers done with it
+static int pcgo;		// measured run may start
+static pthread_cond_t pccond = PTHREAD_COND_INITIALIZER;
+
+/* make the random pattern in b (n bytes, for offset o) unique: every 4k
+ * block gets its offset and the write's sequence number, so no write
+ * repeats earlier data for a deduplicating device to drop */
+static void pcstamp(char *b, size_t n, unsigned long long o,
+                    unsigned long long sq) {
+  size_t i;
+  if (dpat != DPrand) return;
+  for(i = 0; i < n; i += 4096) {
+    ((unsigned long long *)(b + i))[0] = o + i;
+    ((unsigned long long *)(b + i))[1] = sq;
+  }
+}
+
+/* precondition the targets open in fd[] (sfd bytes apart, -1 - not
+ * open): take fill chunks while there are any, then overwrite random
+ * blocks until told to stop */
+#define PCFD(k) (*(const int *)((const char *)fd + (k) * sfd))
+static void pcwork(const int *fd, size_t sfd, unsigned seed) {
+  unsigned short xs[3] = { seed, seed >> 16, 0x1d };
+  unsigned long long sq = (unsigned long long)seed << 40;	// write number
+  unsigned k, n = 0;
+  char *b;
+  if (posix_memalign((void **)&b, 4096, MKCHUNK)) edie("preconditioning buffer");
+  fillpat(b, MKCHUNK, seed);
+  for(k = 0; k < ntg; ++k) {
+    unsigned long long sz = tgs[k].sz - tgs[k].sz % bs, o;
+    if (PCFD(k) < 0) continue;
+    ++n;
+    while(!term && (o = __sync_fetch_and_add(&tgs[k].pcn, 1) * MKCHUNK) < sz) {
+      size_t l = sz - o < MKCHUNK ? sz - o : MKCHUNK;
+      pcstamp(b, l, o, ++sq);
+      if (pwrite(PCFD(k), b, l, o) != (ssize_t)l) {
+        perror(tgs[k].fn);
+        term = 1;
+      }
+      __sync_fetch_and_add(&pcfby, l);
+    }
+  }
+  for(k = 0; n && !pcstop && !term && (!pctot || pcrby < pctot);
+      k = (k + 1) % ntg) {
+    unsigned long long o;
+    if (PCFD(k) < 0) continue;
+    o = ((unsigned long long)nrand48(xs) << 31 | nrand48(xs)) % (tgs[k].sz / bs) * bs;
+    pcstamp(b, bs, o, ++sq);
+    if (pwrite(PCFD(k), b, bs, o) != (ssize_t)bs) {
+      perror(tgs[k].fn);
+      term = 1;
+    }
+    __sync_fetch_and_add(&pcrby, bs);
+  }
+  free(b);
+}
+#undef PCFD
+
+/* fill helper thread: its own fds on all the targets */
+static void *pchelper(void *arg) {
+  unsigned i;
+  int fd[ntg];
+  for(i = 0; i < ntg; ++i)
+    if ((fd[i] = open(tgs[i].fn, O_RDWR | oflags)) < 0)
+      edie(tgs[i].fn);
+  pcwork(fd, sizeof(*fd), (unsigned long)arg);
+  for(i = 0; i < ntg; ++i) {
+    if (fdatasync(fd[i]) < 0) perror(tgs[i].fn);
+    if (evict)
+      posix_fadvise(fd[i], 0, 0, POSIX_FADV_DONTNEED);
+    close(fd[i]);
+  }
+  return 0;
+}
+
+/* worker side: do its share, then wait for the measured run */
+static void pcworker(struct state *s) {
+  pcwork(&s->tg[0].fd, sizeof(*s->tg), pcthr + (s - states) + 1);
+  pthread_mutex_lock(&rnmtx);
+  ++pcpark;
+  pthread_cond_broadcast(&pccond);
+  while(!pcgo)
+    pthread_cond_wait(&pccond, &rnmtx);
+  pthread_mutex_unlock(&rnmtx);
+}
+
+/* set up for a run, before the workers start */
+static void pcinit(void) {
+  unsigned i;
+  pcfill = 0;
+  for(i = 0; i < ntg; ++i) {
+    tgs[i].pcn = 0;
+    pcfill += tgs[i].sz - tgs[i].sz % bs;
+  }
+  pctot = pcmax * pcfill;
+  pcfby = pcrby = pcpark = pcgo = pcstop = 0;
+}
+
+/* run the preconditioning, the workers already in it, reporting
+ * progress, and return once they are ready to start measuring */
+static void precond(void) {
+  unsigned long long ns0 = nsnow(), ns, rns = 0, rb = 0;
+  double w[PCWIN], a = 0, sl;
+  unsigned i, n = 0, st = 0;
+  pthread_t *h;
+  if (!(h = calloc(pcthr, sizeof(*h)))) edie("preconditioning threads");
+  for(i = 0; i < pcthr; ++i)
+    pthread_create(&h[i], NULL, pchelper, (void *)(unsigned long)(i + 1));
+  for(ns = ns0; !term && !st; ) {
+    struct timespec ts = { 0, 200000000 };
+    nanosleep(&ts, NULL);
+    if (pctot && pcrby >= pctot)
+      st = 2;
+    else if (pcfby < pcfill) {
+      fprintf(stderr, "\rpreconditioning: fill %.0f%%", 100.0 * pcfby / pcfill);
+      continue;
+    }
+    if (st)
+      break;
+    if (!rns) {
+      rns = ns = nsnow();
+      rb = pcrby;
+      continue;
+    }
+    if (nsnow() - ns < PCROUND) continue;
+    memmove(w, w + 1, sizeof(w) - sizeof(*w));
+    w[PCWIN - 1] = (pcrby - rb) / ((nsnow() - ns) / 1e9) / bs;
+    rb = pcrby;
+    ns = nsnow();
+    ++n;
+    fprintf(stderr, "\rpreconditioning: round %u %.0f w/s, %.2fx overwritten",
+            n, w[PCWIN - 1], (double)rb / pcfill);
+    if (n >= PCWIN) {
+      double lo = w[0], hi = w[0];
+      for(a = sl = 0, i = 0; i < PCWIN; ++i) {
+        a += w[i];
+        sl += (i - (PCWIN - 1) / 2.0) * w[i];
+        if (w[i] < lo) lo = w[i];
+        if (w[i] > hi) hi = w[i];
+      }
+      a /= PCWIN;
+      sl /= PCWIN * (PCWIN * PCWIN - 1) / 12.0;	// least squares slope
+      if (hi - lo <= a * .2 && fabs(sl) * (PCWIN - 1) <= a * .1)
+        st = 1;
+    }
+  }
+  pcstop = 1;
+  pthread_mutex_lock(&rnmtx);
+  while(pcpark < ntt)
+    pthread_cond_wait(&pccond, &rnmtx);
+  pthread_mutex_unlock(&rnmtx);
+  for(i = 0; i < pcthr; ++i)		// they sync (and evict) last
+    pthread_join(h[i], NULL);
+  free(h);
+  fprintf(stderr, "\rpreconditioned in %.1fs: %llu MB filled, %llu MB overwritten, ",
+          (nsnow() - ns0) / 1e9, pcfby >> 20, pcrby >> 20);
+  if (st == 1)
+    fprintf(stderr, "steady at %.0f w/s\n", a);
+  else
+    fprintf(stderr, "%s\n", term ? "interrupted" : "not steady");
+}
+
+
+void *worker(void *arg) {
+  struct state *s = arg;
+  unsigned k;
+  int one = s->opi == LogWr || s->opi == Replay || s->job;	// one target
+  void (*loop)(struct state *, tick_t) = loopgen;
+  tick_t t1;
+  double u0, sy0;
+  s->workfn = mfl[s->opi] & MFwrt ? fsm == FSdsync ? wdwriter : wwriter : wreader;
+  s->posfn  = mfl[s->opi] & MFrnd ? randpos : linpos;
+  if (s->opi == LogWr) {
+    s->workfn = walwrite;
+    s->posfn = walrecsz;
+  }
+  if (mfl[s->opi] & MFrmw)
+    s->workfn = wrmw;
+  if (s->opi == LinRd && raw)
+    s->posfn = linrapos;
+  if (s->opi == Replay) {
+    s->workfn = wreplay;
+    s->posfn = trpos;
+    s->bcap = maxbs;
+  }
+  else if (s->opi >= LsmRd) {
+    s->workfn = s->opi == LsmRd ? wszread : s->opi == LsmCp ? wcompact :
+                fsm == FSdsync ? wszdwrite : wszwrite;
+    s->posfn = s->opi == LsmRd ? szrpos : szlpos;
   }
+  if (s->job) {		// own I/O size and target
+    s->workfn = !(mfl[s->opi] & MFwrt) ? wszread :
+                fsm == FSdsync ? wszdwrite : wszwrite;
+    s->posfn = mfl[s->opi] & MFrnd ? szrpos : szlpos;
+  }
+  if (s->sch)
+    s->posfn = schpos;
+  if (nullio && s->opi != LogWr && s->opi != Replay)
+    s->workfn = wnull;
+  for(k = 0; !genloop && k < sizeof(loops)/sizeof(loops[0]); ++k)
+    if (loops[k].pos == s->posfn && loops[k].work == s->workfn)
+      loop = loops[k].fn;
+  s->tgm = ntga > 1 && tdist != TDthread && !one;
+  s->tgc = s->job ? jobs[s->job - 1].tg :
+           tdist == TDthread && !one ? (s - states) % ntga : 0;
+  s->tgn = s - states;
+  for(k = 0; k < ntg; ++k) {
+    s->tg[k].fd = -1;
+    if (!s->tgm && k != s->tgc) continue;
+    s->tg[k].fd = open(tgs[k].fn, (mfl[s->opi] & MFrmw || pcond ? O_RDWR :
+                       mfl[s->opi] & MFwrt ? O_WRONLY : O_RDONLY) | oflags);
+    if (s->tg[k].fd < 0) {
+      int e = errno;
+      decnr();
+      errno = e;
+      edie(tgs[k].fn);
+    }
+    if (fadv != -1)
+      posix_fadvise(s->tg[k].fd, 0, 0, fadv != -2 ? fadv :
+                    mfl[s->opi] & MFrnd ? POSIX_FADV_RANDOM : POSIX_FADV_SEQUENTIAL);
+  }
+  s->fd = s->tg[s->tgc].fd;
+  if (pcond)
+    pcworker(s);
+  if (s->prio && syscall(__NR_ioprio_set, IOPRIO_WHO_PROCESS, 0, s->prio) < 0 &&
+      !__sync_fetch_and_or(&priow, 1))
+    fprintf(stderr, "ioprio_set: %m\n");
+  if (s->thk)
+    prctl(PR_SET_TIMERSLACK, 1);	// sleep as precisely as we can
+  if (perf)
+    pevopen(s);
+  thrcpu(&u0, &sy0);
+  t1 = s->stime = ticks();
+  for(k = 0; k < ntg; ++k)
+    s->tg[k].fstm = t1;
+  s->pdue = s->pns = nsnow();
+  loop(s, t1);
+  if (s->opi == Replay)
+    trdone(s);
+  s->etime = ticks();
+  thrcpu(&s->cpuu, &s->cpus);
+  s->cpuu -= u0;
+  s->cpus -= sy0;
+  if (perf)
+    pevclose(s);
+  for(k = 0; k < ntg; ++k)
+    if (s->tg[k].fd >= 0) close(s->tg[k].fd);
+  free(s->rbuf);
   decnr();
   return 0;
 }
@@ -199,68 +2717,683 @@ static void sig(int s) {
   term = s;
 }
 
+static struct tent *trrings;	// recording rings of all threads
+static struct slow *slows;	// slowest I/O heaps of all threads
+static struct tgst *tgsts;	// per target statistics of all threads
+static unsigned long long tm;	// run duration (ns), 0 - unlimited
+static unsigned long long iv;	// statistics interval (ns), 0 - none
+
+/* run the workload once: start all workers, report progress until they
+ * finish, and print the summary */
+static void run(void) {
+  unsigned long long sb0, st0, sb1, st1;
+  unsigned long long ns0, nsi, ns;
+  double cr0 = 0, cr1 = 0;
+  struct state *s = states;
+  struct target *t;
+  char *buf = bufs;
+  unsigned i, j, phc = 0;
+  int fd;
+  pthread_t trt;
+  unsigned long long trn;
+  tick_t rt0;
+
+  for(t = tgs; (evict || resid) && t < tgs + ntg; ++t) {
+    if ((fd = open(t->fn, O_RDONLY)) < 0) continue;
+    if (evict) {
+      fdatasync(fd);
+      if ((errno = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED)))
+        perror("posix_fadvise");
+    }
+    if (resid)
+      cr0 += cacheres(fd, t->sz) / ntg;
+    close(fd);
+  }
+
+  memset(states, 0, ntt * sizeof(*states));
+  for(i = 0; nsch && i < ntt; ++i)
+    if (schlm[2 * i + 1])
+      states[i].sch = sched + (size_t)i * nsch;
+  memset(tgsts, 0, (size_t)ntt * ntg * sizeof(*tgsts));
+  for(i = 0; i < ntt; ++i)
+    states[i].tg = tgsts + (size_t)i * ntg;
+  gbc = 0;
+  if (pcond)
+    pcinit();
+  if (nt[Replay])
+    trreset();
+  pivl(NULL, 0);
+  dl = tm ? ticks() + ns2tk(tm) : 0;
+  running = ntt;
+  syscpu(&sb0, &st0);
+  for(t = tgs; t < tgs + ntg; ++t) {
+    dsget(t, &t->d0);
+    t->di = t->d0;
+  }
+  phns0 = nsi = ns0 = nsnow();
+  rt0 = ticks();
+  if (nt[LogWr])
+    walinit();
+  for(i = 0; nslow && i < ntt; ++i)
+    states[i].slow = slows + (size_t)i * nslow;
+  if (trof) {
+    for(i = 0; i < ntt; ++i)
+      states[i].ring = trrings + (size_t)i * TRING;
+    trt0 = ticks();
+    trn = 0;
+    pthread_create(&trt, NULL, trwriter, &trn);
+  }
+  for(j = 0; j < NM; ++j)
+    for(i = 0; i < nt[j]; ++i) {
+      pthread_t t;
+      s->buf = buf; buf += maxbs;
+      s->opi = j;
+      s->i = i;
+      s->iosz = msz[j] ? msz[j] : bs;
+      s->nb = (unsigned long long)bc * bs / s->iosz;
+      s->rate = mrate[j] / nt[j];
+      s->prio = mprio[j];
+      s->php = nph && j != Replay;
+      s->thk = mthk[j];
+      s->dl = dl;
+      pthread_create(&t, NULL, worker, s++);
+    }
+  for(j = 0; j < njob; ++j)
+    for(i = 0; i < jobs[j].nt; ++i) {
+      pthread_t t;
+      tick_t jdl = jobs[j].tm ? ticks() + ns2tk(jobs[j].tm) : 0;
+      s->buf = buf; buf += maxbs;
+      s->opi = jobs[j].opi;
+      s->job = j + 1;
+      s->i = i;
+      s->iosz = jobs[j].iosz ? jobs[j].iosz : bs;
+      s->nb = tgs[jobs[j].tg].sz / s->iosz;
+      s->rate = jobs[j].rate / jobs[j].nt;
+      s->prio = jobs[j].prio;
+      s->thk = jobs[j].thk;
+      s->dl = jdl && (!dl || jdl < dl) ? jdl : dl;
+      pthread_create(&t, NULL, worker, s++);
+    }
+  if (pcond) {		// measuring starts after it
+    tick_t sh = ticks();
+    precond();
+    sh = ticks() - sh;
+    for(i = 0; i < ntt; ++i)
+      if (states[i].dl) states[i].dl += sh;
+    if (dl) dl += sh;
+    syscpu(&sb0, &st0);
+    for(t = tgs; t < tgs + ntg; ++t) {
+      dsget(t, &t->d0);
+      t->di = t->d0;
+    }
+    phns0 = nsi = ns0 = nsnow();
+    trt0 = rt0 = ticks();
+    pthread_mutex_lock(&rnmtx);
+    pcgo = 1;
+    pthread_mutex_unlock(&rnmtx);
+    pthread_cond_broadcast(&pccond);
+  }
+  pthread_mutex_lock(&rnmtx);
+  while(running) {
+    if (!iv) {		// progress on stderr every second
+      struct timespec ts;
+      ns = nsnow() + 1000000000;
+      ts.tv_sec = ns / 1000000000;
+      ts.tv_nsec = ns % 1000000000;
+      pthread_cond_timedwait(&rncond, &rnmtx, &ts);
+      if (running && !selfb) {
+        putc('\r', stderr);
+        pst(stderr);
+      }
+      continue;
+    }
+    ns = nsi + iv;
+    if (nsnow() < ns) {
+      struct timespec ts = { ns / 1000000000, ns % 1000000000 };
+      pthread_cond_timedwait(&rncond, &rnmtx, &ts);
+      continue;
+    }
+    pthread_mutex_unlock(&rnmtx);
+    ns = nsnow();
+    printf("%8.3fs", (ns - ns0) / 1e9);
+    if (nph) {
+      unsigned seg;
+      phrate(&phc, nsi - ns0, &seg);	// phase the interval began in
+      printf(" [%s]", phs[phc].name);
+    }
+    pivl(stdout, (ns - nsi) / 1e9);
+    for(t = tgs; t < tgs + ntg; ++t) {
+      dsget(t, &t->d1);
+      pdev(stdout, t, &t->di, &t->d1, (ns - nsi) / 1e9);
+      t->di = t->d1;
+    }
+    putc('\n', stdout);
+    fflush(stdout);
+    nsi = ns;
+    pthread_mutex_lock(&rnmtx);
+  }
+  pthread_mutex_unlock(&rnmtx);
+  if (trof) {
+    unsigned long long dr = 0;
+    pthread_join(trt, NULL);
+    for(i = 0; i < ntt; ++i)
+      dr += states[i].rdrop;
+    if (!selfb)
+      fprintf(stderr, "\rrecorded %llu I/Os, %llu dropped\n", trn, dr);
+  }
+  if (selfb)
+    return;
+
+  syscpu(&sb1, &st1);
+  for(t = tgs; t < tgs + ntg; ++t)
+    dsget(t, &t->d1);
+  ns = nsnow();
+
+  putc('\r', stderr);
+  pst(stdout);
+  putc('\n', stdout);
+  if (ntg > 1)
+    ptg(stdout, (ns - ns0) / 1e9);
+  pjob(stdout);
+  plat(stdout);
+  pslow(stdout, rt0);
+  pthk(stdout);
+  pwal(stdout);
+  pgeom(stdout);
+  if (resid) {
+    for(t = tgs; t < tgs + ntg; ++t)
+      if ((fd = open(t->fn, O_RDONLY)) >= 0) {
+        cr1 += cacheres(fd, t->sz) / ntg;
+        close(fd);
+      }
+    printf(" cache resident %.1f%% before, %.1f%% after\n",
+           cr0 * 100, cr1 * 100);
+  }
+  pcpu(stdout, sb1 - sb0, st1 - st0);
+  for(t = tgs; t < tgs + ntg; ++t)
+    if (t->dsfn[0]) {
+      pdev(stdout, t, &t->d0, &t->d1, (ns - ns0) / 1e9);
+      putc('\n', stdout);
+    }
+  if (perf)
+    ppev(stdout);
+  fflush(stdout);
+}
+
+/* Self-benchmark (-B): run one thread on the null engine, adding the
+ * optional per-I/O bookkeeping step by step, and print the I/O rate of
+ * each configuration and its cost per I/O: what iot itself takes.  A
+ * recording row whose ring overflowed shows the share of I/Os dropped
+ * (which skip most of the recording work) and is marked unreliable. */
+static void selfbench(void) {
+  static const char *const cn[] = {
+    "minimal", "generic loop", "slow I/Os", "recording", "all"
+  };
+  unsigned c, k0 = nslow;
+  FILE *tf = trof;
+  printf("self-benchmark: %s on null engine, %.1fs each, %s clock\n",
+         ion[RndRd], tm / 1e9, usetsc ? "TSC" : "monotonic");
+  for(c = 0; c < sizeof(cn)/sizeof(cn[0]) && !term; ++c) {
+    double sec;
+    genloop = c == 1;
+    nslow = c == 2 || c == 4 ? k0 : 0;
+    trof = c >= 3 ? tf : NULL;
+    run();
+    sec = tk2ns(states[0].etime - states[0].stime) / 1e9;
+    printf(" %-12s %10.0f io/s %7.1f ns/io", cn[c],
+           states[0].ioc / sec, states[0].ioc ? sec * 1e9 / states[0].ioc : 0);
+    if (states[0].rdrop)
+      printf(", %.3f%% not recorded: unreliable",
+             100.0 * states[0].rdrop / states[0].ioc);
+    putchar('\n');
+    fflush(stdout);
+  }
+  genloop = 0;
+  nslow = k0;
+  trof = tf;
+}
+
+/* Target provisioning (-C): grow target files to mksz, allocating the
+ * space first, then writing the new part in MKCHUNK pieces by mkthr
+ * threads, each taking a contiguous share. */
+static unsigned long long mksz;	// size to create targets with, 0 - no
+static unsigned mkthr;		// fill threads, 0 - one per CPU
+static int mkdel;		// remove created targets when done
+static unsigned long long mkdone;	// bytes written by fill threads
+static unsigned mkrun;		// fill threads running
+
+struct mkfill {
+  pthread_t t;
+  int fd;
+  unsigned long long off, end;	// part to write
+  char *buf;
+};
+
+static void *mkfiller(void *arg) {
+  struct mkfill *m = arg;
+  while(m->off < m->end && !term) {
+    size_t n = m->end - m->off < MKCHUNK ? m->end - m->off : MKCHUNK, i;
+    ssize_t r;
+    if (dpat == DPrand)		// no two blocks alike, for dedup devices
+      for(i = 0; i < n; i += 4096)
+        *(unsigned long long *)(m->buf + i) = m->off + i;
+    if ((r = pwrite(m->fd, m->buf, n, m->off)) <= 0) {
+      perror("fill");
+      break;
+    }
+    m->off += r;
+    __sync_fetch_and_add(&mkdone, r);
+  }
+  __sync_fetch_and_sub(&mkrun, 1);
+  return 0;
+}
+
+/* create or extend target t to mksz and fill the new part */
+static void mktarget(struct target *t) {
+  unsigned long long o, sz = (mksz + 4095) & ~4095ULL, ns0;
+  double el;
+  struct mkfill *m;
+  struct stat st;
+  unsigned i, n = mkthr ? mkthr : sysconf(_SC_NPROCESSORS_ONLN);
+  int fd;
+  if (stat(t->fn, &st) == 0) {
+    if (!S_ISREG(st.st_mode) || (unsigned long long)st.st_size >= sz)
+      return;
+  }
+  else if (errno == ENOENT)
+    t->mk = 1;
+  else
+    edie(t->fn);
+  o = t->mk ? 0 : st.st_size & ~4095ULL;
+  if ((fd = open(t->fn, O_RDWR|O_CREAT|(oflags & O_DIRECT), 0666)) < 0)
+    edie(t->fn);
+  if ((errno = posix_fallocate(fd, o, sz - o)))
+    perror("posix_fallocate");
+  if (n > (sz - o + MKCHUNK - 1) / MKCHUNK)
+    n = (sz - o + MKCHUNK - 1) / MKCHUNK;
+  if (!(m = calloc(n, sizeof(*m)))) edie("fill threads");
+  mkdone = 0;
+  mkrun = n;
+  ns0 = nsnow();
+  for(i = 0; i < n; ++i) {
+    unsigned long long c = (sz - o + MKCHUNK - 1) / MKCHUNK;	// chunks
+    m[i].fd = fd;
+    m[i].off = o + c * i / n * MKCHUNK;
+    m[i].end = i + 1 < n ? o + c * (i + 1) / n * MKCHUNK : sz;
+    if (posix_memalign((void **)&m[i].buf, 4096, MKCHUNK)) edie("fill buffer");
+    fillpat(m[i].buf, MKCHUNK, i + 1);
+    pthread_create(&m[i].t, NULL, mkfiller, &m[i]);
+  }
+  while(mkrun) {
+    struct timespec ts = { 0, 200000000 };
+    nanosleep(&ts, NULL);
+    fprintf(stderr, "\rfilling %s: %.0f%%", t->fn, 100.0 * mkdone / (sz - o));
+  }
+  for(i = 0; i < n; ++i) {
+    pthread_join(m[i].t, NULL);
+    free(m[i].buf);
+  }
+  free(m);
+  if (fsync(fd) < 0) perror(t->fn);
+  close(fd);
+  el = (nsnow() - ns0) / 1e9;
+  fprintf(stderr, "\r%s %s: %llu MB in %.1fs, %.0f MB/s by %u threads\n",
+          t->mk ? "created" : "extended", t->fn, mkdone >> 20,
+          el, mkdone / el / 1048576, n);
+  if (term) {
+    fprintf(stderr, "%s: fill interrupted\n", t->fn);
+    exit(1);
+  }
+}
+
 int main(int argc, char **argv) {
   int c;
-  unsigned i, j;
-  unsigned tm = 0;
-  struct state *s;
-  char *buf;
+  unsigned i, trw = 0;
+  pthread_condattr_t ca;
+  struct stat st;
+  struct geom g0;
+  unsigned long long sz, msz0 = 0;
+  int jw = 0;			// some job writes
 
-  while((c = getopt(argc, argv, "r::R::w::W::dsb:n:i:t:h")) != EOF) switch(c) {
+  while((c = getopt(argc, argv, "r::R::w::W::L::U::u:K:F:j:S:O:k:m:J:p:G:Z:x:NBC:Ef:D:dsb:n:i:I:t:T::Pv:ea:cA:X:y:l:g:h")) != EOF) switch(c) {
   case 'r': nt[LinRd] = optarg ? atoi(optarg) : 1; break;
   case 'R': nt[RndRd] = optarg ? atoi(optarg) : 1; break;
   case 'w': nt[LinWr] = optarg ? atoi(optarg) : 1; break;
   case 'W': nt[RndWr] = optarg ? atoi(optarg) : 1; break;
+  case 'L': nt[LogWr] = optarg ? atoi(optarg) : 1; break;
+  case 'U': nt[RmwUp] = optarg ? atoi(optarg) : 1; break;
+  case 'u': rmwsz = parsesz(optarg); break;
+  case 'K': parselsm(optarg); break;
+  case 'F': trfn = optarg; break;
+  case 'j': trw = atoi(optarg); break;
+  case 'S': trspeed = atof(optarg); break;
+  case 'k': nslow = atoi(optarg); break;
+  case 'J': parsejob(optarg); break;
+  case 'p': parsemprio(optarg); break;
+  case 'G': parseph(optarg); break;
+  case 'Z': parsemthk(optarg); break;
+  case 'N': nullio = 1; break;
+  case 'B': selfb = 1; break;
+  case 'C': {
+    char *p = strchr(optarg, ',');
+    if (p) {
+      *p++ = '\0';
+      mkthr = atoi(p);
+    }
+    mksz = parsesz(optarg);
+    break;
+  }
+  case 'E': mkdel = 1; break;
+  case 'f': dpat = parsepat(optarg); break;
+  case 'D': {
+    char *p = strchr(optarg, ','), *e;
+    pcond = 1;
+    if (p) {
+      *p++ = '\0';
+      pcthr = atoi(p);
+    }
+    pcmax = strtod(optarg, &e);
+    if (e == optarg || *e || pcmax < 0) {
+      fprintf(stderr, "invalid overwrite limit `%s'\n", optarg);
+      exit(1);
+    }
+    break;
+  }
+  case 'x': {
+    char *p = strchr(optarg, ',');
+    if (p) {
+      *p++ = '\0';
+      schfn = p;
+    }
+    nsch = parsesz(optarg);
+    break;
+  }
+  case 'm': {
+    char *p = strchr(optarg, ':');
+    if (p) *p++ = '\0';
+    if (strcmp(optarg, "rr") == 0) tdist = TDrr;
+    else if (strcmp(optarg, "stripe") == 0) tdist = TDstripe;
+    else if (strcmp(optarg, "thread") == 0) tdist = TDthread;
+    else {
+      fprintf(stderr, "-m: unknown distribution `%s'\n", optarg);
+      exit(1);
+    }
+    if (p && (tdist != TDstripe || !(tsu = parsesz(p)))) {
+      fprintf(stderr, "-m: invalid stripe unit `%s'\n", p);
+      exit(1);
+    }
+    break;
+  }
+  case 'O':
+    if (!(trof = fopen(optarg, "w"))) edie(optarg);
+    fputs(TRMAGIC, trof);
+    break;
+  case 'l': {
+    char *p = strchr(optarg, ',');
+    walmin = parsesz(p ? (*p = '\0', optarg) : optarg);
+    walmax = p ? parsesz(p + 1) : walmin;
+    if (!walmin || walmax < walmin) {
+      fprintf(stderr, "-l: invalid record size range\n");
+      exit(1);
+    }
+    break;
+  }
+  case 'g': {
+    char *p = strchr(optarg, ',');
+    if (strcmp(optarg, "off") == 0) {
+      gcmax = 0;
+      break;
+    }
+    if (p) {
+      *p++ = '\0';
+      gcmax = parsesz(p);
+    }
+    gcdelay = parsetm(optarg);
+    break;
+  }
   case 'd': oflags |= O_DIRECT; break;
   case 's': oflags |= O_SYNC; break;
-  case 'b': bs = atoi(optarg); break;
+  case 'b': bs = strcmp(optarg, "auto") ? atoi(optarg) : 0; break;
   case 'n': bc = atoi(optarg); break;
   case 'i': bm = atoi(optarg); break;
-  case 't': tm = atoi(optarg); break;
+  case 'I': gbm = strtoull(optarg, NULL, 0); break;
+  case 't': tm = parsetm(optarg); break;
+  case 'T': usetsc = optarg ? atoi(optarg) : 1; break;
+  case 'P': perf = 1; break;
+  case 'v': iv = parsetm(optarg); break;
+  case 'e': evict = 1; break;
+  case 'a': fadv = parseadv(optarg); break;
+  case 'c': resid = 1; break;
+  case 'y': parsefs(optarg); break;
+  case 'A': {
+    char *p = strchr(optarg, ',');
+    if (p) {
+      *p++ = '\0';
+      if (strcmp(p, "willneed") == 0) rawn = 1;
+      else if (strcmp(p, "readahead")) {
+        fprintf(stderr, "-A: unknown readahead method `%s'\n", p);
+        exit(1);
+      }
+    }
+    raw = parsesz(optarg);
+    break;
+  }
+  case 'X': {
+    char *p;
+    for(p = strtok(optarg, ","); p; p = strtok(NULL, ",")) {
+      if (nra == sizeof(ra)/sizeof(ra[0])) {
+        fprintf(stderr, "-X: too many readahead values\n");
+        exit(1);
+      }
+      ra[nra++] = parsesz(p) / 1024;
+    }
+    break;
+  }
   case 'h':
     puts(
 "iotest: perform I/O speed test\n"
-"Usage is: iotest [options] device-or-file\n"
+"Usage is: iotest [options] device-or-file... (or -J job-file)\n"
 "options:\n"
 " -r[n] - linear read test (n readers)\n"
 " -R[n] - random read test (n readers)\n"
 " -w[n] - linear write test (n writers)\n"
 " -W[n] - random write test (n writers)\n"
+" -L[n] - log append test with group commit (n writers)\n"
+" -U[n] - random read-modify-write test (n updaters)\n"
+" -u sz - bytes changed by each read-modify-write (default 16)\n"
+" -K opt=val,... - LSM store emulation: rd, fl, cp - number of point\n"
+"      reader, flush and compaction threads (default 1 each); rdsz, flsz,\n"
+"      cpsz - their I/O sizes (4k, 1m, 1m); rdrate, flrate, cprate -\n"
+"      their bytes/s limits (default none; compaction counts bytes read\n"
+"      and written)\n"
+" -F trace - replay I/O trace (text: \"sec R|W|F offset length [stream]\"\n"
+"      lines, or binary as recorded by -O)\n"
+" -j n - number of replay workers (default 1)\n"
+" -S speed - replay time scale: 1 - original timing (default), 2 - twice\n"
+"      as fast, etc, 0 - as fast as possible\n"
+" -k n - report n slowest I/Os with their context (default 10, 0 - off)\n"
+" -J file - also run the workload groups of job file: sections [name]\n"
+"      with target=file, mode=read|randread|write|randwrite, bs=size,\n"
+"      threads=n, rate=bytes/s, time=interval, prio=class[:level] and\n"
+"      think=dist; each is reported apart\n"
+" -p [mode=]class[:level],... - I/O priority (rt, be or idle, level 0-7,\n"
+"      default 4) of the mode's threads (LinRd, RndWr...; all if none);\n"
+"      prio=class[:level] in a job file section does it for the job\n"
+" -x n[,file] - precompute n random positions per thread and cycle\n"
+"      through them; keep them in file and reuse them if they match\n"
+" -Z [mode=]dist,... - think time between I/Os of each thread (of the\n"
+"      mode, or all): time, exp:mean, uni:min:max or file:name (times to\n"
+"      draw from); spin=time - spin instead of sleeping for the last\n"
+"      this much of a wait (default 50us); think=dist for jobs\n"
+" -G phase,... - vary the rate of command line modes over time, phases\n"
+"      being [name=]time@rate (hold), time@rate~rate (ramp) or\n"
+"      time@base/burst:period:len (bursts); rate in bytes/s, max -\n"
+"      unlimited, 0 - idle.  -G @file follows \"sec rate [name]\" points\n"
+" -m how - spread I/O over several targets: rr - round-robin (default),\n"
+"      stripe[:unit] - by offset in stripe units (default 64k), thread -\n"
+"      each thread uses one target\n"
+" -O file - record every I/O issued (binary, replayable with -F)\n"
+" -l min[,max] - log record size range (default 128,4096)\n"
+" -g delay[,max] - group commit: leader waits delay for more records,\n"
+"      commits at most max bytes (default 0,1m); off - no grouping\n"
+" -C size[,n] - create (or extend) target files to size, allocating and\n"
+"      filling them with the data pattern by n threads (default one per\n"
+"      CPU)\n"
+" -E - remove the target files created by -C when done\n"
+" -f pattern - data to write: zero (default), rand, or a byte value\n"
+" -D max[,n] - precondition: fill the targets sequentially, then overwrite\n"
+"      random blocks until the write rate is steady or max times the\n"
+"      capacity was overwritten (0 - no limit), with n helper threads\n"
+"      (default one per CPU) besides the workers; then measure\n"
+" -N - null engine: no syscalls for I/O (target defaults to /dev/null)\n"
+" -B - self-benchmark: measure iot's own per-I/O overhead with -N\n"
 " -d - use direct I/O (O_DIRECT)\n"
 " -s - use syncronous I/O (O_SYNC)\n"
-" -b bs - blocksize (default is 8192)\n"
+" -b bs - blocksize (default is 8192, auto - pick from device geometry)\n"
 " -n bc - block count (default is whole device/file)\n"
-" -i nb - number of I/O iterations to perform\n"
-" -t sec - time to spend on all I/O\n"
+" -i nb - number of I/O iterations to perform (by each thread)\n"
+" -I nb - number of I/O iterations to perform (by all threads)\n"
+" -t time - time to spend on all I/O (sec, or with ns/us/ms/s/m/h suffix)\n"
+" -T[0|1] - use (1) or don't use (0) TSC for timing (default: if invariant)\n"
+" -P - count perf events (cycles, instructions, cache misses,\n"
+"      context switches...) in each worker and report them per I/O\n"
+" -v time - print application and device statistics every time interval\n"
+" -e - evict target's pages from page cache before the run\n"
+" -a adv - fadvise workers' files: normal, random, sequential, noreuse,\n"
+"      or auto (random or sequential according to the mode)\n"
+" -c - measure page cache residency of the target before and after\n"
+" -A win[,willneed] - read ahead win bytes past linear readers' cursor\n"
+"      with readahead() (or posix_fadvise(WILLNEED))\n"
+" -X ra,ra... - repeat the run for each device readahead setting (bytes,\n"
+"      k/m suffix ok), evicting the target from cache before each run\n"
+" -y how[:every] - flush writes: fsync or fdatasync every n writes\n"
+"      (default 1) or every time interval (with suffix, eg 10ms);\n"
+"      sfr[:size] - sync_file_range() windows of size bytes (default 1m):\n"
+"      start writeback of each, wait for the previous one;\n"
+"      dsync - RWF_DSYNC on each write\n"
 " -h - this help\n"
-"It's ok to specify all, one or some of -r,-R,-w and -W\n"
+"It's ok to specify all, one or some of -r,-R,-w,-W,-L and -U\n"
 );
     return 0;
   default: fprintf(stderr, "try `iotest -h' for help\n"); exit(1);
   }
 
-  if (optind + 1 != argc) {
-    fprintf(stderr, "exactly one device/file argument expected\n");
-    return 1;
+  if (selfb) {		// one random reader, nothing else
+    memset(nt, 0, sizeof(nt));
+    nt[RndRd] = 1;
+    njob = nph = nsch = pcond = 0;
+    memset(mthk, 0, sizeof(mthk));
+    trfn = NULL;
+    nullio = 1;
+    if (!tm) tm = 1000000000;
+    if (!nslow) nslow = 10;
+    if (!trof && !(trof = fopen("/dev/null", "w"))) edie("/dev/null");
+  }
+  ntga = argc - optind;
+  if (!(tgs = calloc(ntga + njob + 1, sizeof(*tgs)))) edie("targets");
+  for(ntg = 0; ntg < ntga; ++ntg)
+    tgs[ntg].fn = argv[optind + ntg];
+  if (!ntga && nullio)
+    tgs[ntg++].fn = "/dev/null", ++ntga;
+  for(i = 0; i < njob; ++i) {
+    unsigned k;
+    for(k = 0; k < ntg && strcmp(tgs[k].fn, jobs[i].fn); ++k) ;
+    if (k == ntg) tgs[ntg++].fn = jobs[i].fn;
+    jobs[i].tg = k;
   }
-  fn = argv[optind];
+  if (pcond && !pcthr)
+    pcthr = sysconf(_SC_NPROCESSORS_ONLN);
+  signal(SIGINT, sig);
+  for(i = 0; mksz && i < ntg; ++i)
+    mktarget(&tgs[i]);
 
-  ntt = nt[0] + nt[1] + nt[2] + nt[3];
-  if (!ntt)
+  if (trfn) {
+    trinit();
+    nt[Replay] = trw ? trw : 1;
+  }
+  for(ntt = i = 0; i < NM; ++i)
+    ntt += nt[i];
+  if (!ntt && !njob)
     nt[LinRd] = ntt = 1;
+  if (ntt && !ntga) {
+    fprintf(stderr, "device/file argument expected\n");
+    return 1;
+  }
+  fn = tgs[0].fn;
+  for(i = 0; i < NM; ++i)
+    if (i != Replay) nphthr += nt[i];
+  if (nph && !tm)
+    tm = phlen;
+  for(i = 0; i < njob; ++i) {
+    ntt += jobs[i].nt;
+    if (mfl[jobs[i].opi] & MFwrt) jw = 1;
+  }
 
-  c = open(fn, (nt[LinWr] + nt[RndWr] ? O_RDWR : O_RDONLY) | oflags);
-  if (c < 0) edie(fn);
-  if (!bc) {
-    unsigned long long sz;
-    struct stat st;
+  /* check all targets; the geometry of the first one is kept */
+  for(i = 0; i < ntg; ++i) {
+    unsigned k;
+    c = open(tgs[i].fn, (nt[LinWr] + nt[RndWr] + nt[LogWr] + nt[RmwUp] +
+                  nt[LsmFl] + nt[LsmCp] + nt[Replay] + jw ? O_RDWR : O_RDONLY) | oflags);
+    if (c < 0) edie(tgs[i].fn);
     fstat(c, &st);
+    memset(&geo, 0, sizeof(geo));
+    geominit(c, &st);
+    geomcheck(tgs[i].fn, nt[LinWr] + nt[RndWr] + nt[RmwUp] + jw);
+    if (!i) g0 = geo;
+    sz = 0;
     if (st.st_size) sz = st.st_size;
     else ioctl(c, BLKGETSIZE64, &sz);
-    bc = sz / bs;
-//    fprintf(stderr, "size = %lld (%u blocks)\n", sz, bc);
+    if (!sz && nullio)		// eg /dev/null: any size will do
+      sz = (unsigned long long)bs << 20;
+    if (i < ntga && (!i || sz < msz0)) msz0 = sz;
+    tgs[i].sz = sz;
+    close(c);
+    for(k = 0; k < njob; ++k) {
+      unsigned n = jobs[k].iosz ? jobs[k].iosz : bs;
+      if (jobs[k].tg != i) continue;
+      if ((oflags & O_DIRECT) && n % geo.dioalign) {
+        fprintf(stderr, "job %s: I/O size %u is not a multiple of direct I/O"
+                        " alignment %u\n", jobs[k].name, n, geo.dioalign);
+        exit(1);
+      }
+      if (sz < n) {
+        fprintf(stderr, "job %s: %s is smaller than I/O size\n",
+                jobs[k].name, tgs[i].fn);
+        exit(1);
+      }
+    }
+  }
+  geo = g0;
+  if (rmwsz > bs) rmwsz = bs;
+  if (raw && ntga > 1 && tdist != TDthread) {
+    fprintf(stderr, "warning: -A needs a single target or -m thread,"
+                    " ignored\n");
+    raw = 0;
   }
-  close(c);
+  if (raw)
+    raw = raw < bs ? 1 : raw / bs;
+  if (nra)
+    evict = 1;
+  if (ntga > 1 && tdist == TDstripe) {
+    for(i = 0; i < NM; ++i)
+      if (nt[i] && i != LogWr && i != Replay && tsu % (msz[i] ? msz[i] : bs)) {
+        fprintf(stderr, "stripe unit %llu is not a multiple of %s I/O size\n",
+                tsu, ion[i]);
+        exit(1);
+      }
+    msz0 -= msz0 % tsu;
+  }
+  if (!bc)
+    bc = msz0 * (ntga > 1 && tdist == TDstripe ? ntga : 1) / bs;
+  tgsz = (unsigned long long)bc * bs / (ntga > 1 && tdist == TDstripe ? ntga : 1);
+  for(i = 0; i < ntga; ++i)
+    tgs[i].sz = tgsz;
+  for(i = 0; i < NM; ++i)
+    if (nt[i] && (unsigned long long)bc * bs < msz[i]) {
+      fprintf(stderr, "%s: target is smaller than %s I/O size\n",
+              tgs[0].fn, ion[i]);
+      exit(1);
+    }
   if (nt[RndRd] || nt[RndWr]) {
 #ifdef USE_DEV_URANDOM
     randfd = open("/dev/urandom", O_RDONLY);
@@ -277,30 +3410,55 @@ int main(int argc, char **argv) {
   }
 
   states = calloc(ntt, sizeof(*states));
-  s = states;
-  buf = valloc(ntt * bs);
-  if (tm) {
-    signal(SIGALRM, sig);
-    alarm(tm);
+  for(maxbs = bs, i = 0; i < NM; ++i)
+    if (nt[i] && maxbs < msz[i])
+      maxbs = msz[i];
+  for(i = 0; i < njob; ++i)
+    if (maxbs < jobs[i].iosz)
+      maxbs = jobs[i].iosz;
+  if (!(bufs = valloc((size_t)ntt * maxbs))) edie("I/O buffers");
+  for(i = 0; i < ntt; ++i)
+    fillpat(bufs + (size_t)i * maxbs, maxbs, i + 1);
+  if (nslow && !(slows = malloc((size_t)ntt * nslow * sizeof(*slows))))
+    edie("slow I/O buffers");
+  if (!(tgsts = calloc((size_t)ntt * ntg, sizeof(*tgsts))))
+    edie("target statistics");
+  if (nsch)
+    schinit();
+  if (trof && !(trrings = malloc((size_t)ntt * TRING * sizeof(struct tent))))
+    edie("recording buffers");
+  tkinit();
+  fst = ns2tk(fst);
+  pthread_condattr_init(&ca);
+  pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+  pthread_cond_init(&rncond, &ca);
+  for(i = 0; i < ntg; ++i)
+    dsinit(&tgs[i]);
+
+  if (selfb)
+    selfbench();
+  else if (!nra)
+    run();
+  else if (rainit() < 0) {
+    fprintf(stderr, "%s: can't change device readahead, running with"
+                    " current setting\n", rafn[0] ? rafn : fn);
+    run();
   }
-  running = ntt;
-  for(j = 0; j < 4; ++j)
-    for(i = 0; i < nt[j]; ++i) {
-      pthread_t t;
-      s->buf = buf; buf += bs;
-      s->opi = j;
-      s->i = i;
-      pthread_create(&t, NULL, worker, s++);
+  else {
+    for(i = 0; i < nra && !term; ++i) {
+      if (raset(ra[i]) < 0) {
+        perror(rafn);
+        break;
+      }
+      printf("readahead %uK:\n", ra[i]);
+      fflush(stdout);
+      run();
     }
-  while(running) {
-    pthread_cond_wait(&rncond, &rnmtx);
-    putc('\r', stderr);
-    pst(stderr);
+    raset(ra0);
   }
 
-  putc('\r', stderr);
-  pst(stdout);
-  putc('\n', stdout);
-
+  for(i = 0; mkdel && i < ntg; ++i)
+    if (tgs[i].mk && unlink(tgs[i].fn) < 0)
+      perror(tgs[i].fn);
   return 0;
 }